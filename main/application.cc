@@ -9,6 +9,8 @@
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "outfit_analyzer.h"
+#include "memory_policy.h"
+#include "json_arena.h"
 
 // 添加这行
 extern "C" {
@@ -39,8 +41,20 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
+// 情绪灯效映射用到的本地工具，名称哈希在编译期计算
+static constexpr McpToolKey kSwitchLightModeTool("self.chassis.switch_light_mode");
+static constexpr McpToolKey kDanceTool("self.chassis.dance");
+
+// A field that is missing or not a string gives a view with a null data()
+static std::string_view GetStringView(const cJSON* root, const char* key) {
+    auto item = cJSON_GetObjectItem(root, key);
+    return cJSON_IsString(item) ? std::string_view(item->valuestring) : std::string_view();
+}
+
 Application::Application() {
     event_group_ = xEventGroupCreate();
+    // Incoming messages are parsed in per-message arenas, see JsonArena
+    JsonArena::InstallHooks();
 
 #if CONFIG_USE_DEVICE_AEC && CONFIG_USE_SERVER_AEC
 #error "CONFIG_USE_DEVICE_AEC and CONFIG_USE_SERVER_AEC cannot be enabled at the same time"
@@ -253,21 +267,23 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
+            OpenAudioChannel([this](bool success) {
+                if (success) {
+                    SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
                 }
-            }
-
-            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            });
+        });
+    } else if (device_state_ == kDeviceStateConnecting) {
+        Schedule([this]() {
+            CancelOpenAudioChannel();
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
     } else if (device_state_ == kDeviceStateListening) {
-        Schedule([this]() {
+        SendControl([this]() {
+            FlushQueuedAudio();
             protocol_->CloseAudioChannel();
         });
     }
@@ -290,14 +306,11 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
+            OpenAudioChannel([this](bool success) {
+                if (success) {
+                    SetListeningMode(kListeningModeManualStop);
                 }
-            }
-
-            SetListeningMode(kListeningModeManualStop);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -314,10 +327,11 @@ void Application::StopListening() {
         return;
     }
 
-    const std::array<int, 3> valid_states = {
+    const std::array<int, 4> valid_states = {
         kDeviceStateListening,
         kDeviceStateSpeaking,
         kDeviceStateIdle,
+        kDeviceStateConnecting,
     };
     // If not valid, do nothing
     if (std::find(valid_states.begin(), valid_states.end(), device_state_) == valid_states.end()) {
@@ -326,8 +340,14 @@ void Application::StopListening() {
 
     Schedule([this]() {
         if (device_state_ == kDeviceStateListening) {
-            protocol_->SendStopListening();
+            SendControl([this]() {
+                FlushQueuedAudio();
+                protocol_->SendStopListening();
+            });
             SetDeviceState(kDeviceStateIdle);
+        } else if (device_state_ == kDeviceStateConnecting) {
+            // Released before the channel was ready, there is nothing to listen to
+            CancelOpenAudioChannel();
         }
     });
 }
@@ -349,7 +369,7 @@ void Application::Start() {
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        sender_.NotifyAudio();
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
@@ -357,6 +377,11 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    callbacks.on_end_of_utterance = [this]() {
+        Schedule([this]() {
+            OnEndOfUtterance();
+        });
+    };
     audio_service_.SetCallbacks(callbacks);
 
     /* Start the clock timer to update the status bar */
@@ -473,93 +498,56 @@ void Application::Start() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
-        if (device_state_ == kDeviceStateSpeaking) {
-            audio_service_.PushPacketToDecodeQueue(std::move(packet));
-        }
+        OnIncomingAudio(std::move(packet));
+    });
+    McpServer::GetInstance().OnPingReply([this](int rtt_ms) {
+        protocol_->AddRttSample(rtt_ms);
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveMode(false);
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
+            ESP_LOGI(TAG, "Server sample rate %d differs from device output sample rate %d",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        // The next session sends initialize again
+        McpServer::GetInstance().ResetSession();
         Schedule([this]() {
+            FlushEarlyAudioPackets(false);
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
+    protocol_->OnIncomingControl([this](const ControlMessage& message) {
+        switch (message.type) {
+        case kControlMessageTts:
+            OnTtsMessage(message.state, message.text);
+            return true;
+        case kControlMessageStt:
+            OnSttMessage(message.text);
+            return true;
+        case kControlMessageLlm:
+            OnLlmEmotion(message.emotion);
+            return true;
+        default:
+            return false;
+        }
+    });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
         // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
         if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
+            OnTtsMessage(GetStringView(root, "state"), GetStringView(root, "text"));
         } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
+            OnSttMessage(GetStringView(root, "text"));
         } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    // 更新表情
-                    display->SetEmotion(emotion_str.c_str());
-
-                    // 情绪→灯光映射
-                    auto& mcp = McpServer::GetInstance();
-                    if (emotion_str == "happy") {
-                        // 明亮/活跃灯效：示例取 6（允许范围 3..8）
-                        mcp.CallToolLocal("self.chassis.switch_light_mode", std::string("{\"light_mode\":6}"));
-                        // 可选：触发跳舞
-                        mcp.CallToolLocal("self.chassis.dance");
-                    } else if (emotion_str == "sad") {
-                        // 柔和灯效：示例取 3
-                        mcp.CallToolLocal("self.chassis.switch_light_mode", std::string("{\"light_mode\":3}"));
-                    } else if (emotion_str == "angry") {
-                        // 强烈灯效：示例取 8
-                        mcp.CallToolLocal("self.chassis.switch_light_mode", std::string("{\"light_mode\":}"));
-                    } else if (emotion_str == "calm" || emotion_str == "neutral") {
-                        // 中性/舒缓：示例取 4 或 5
-                        mcp.CallToolLocal("self.chassis.switch_light_mode", std::string("{\"light_mode\":4}"));
-                    }
-                });
-            }
+            OnLlmEmotion(GetStringView(root, "emotion"));
         } else if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
+            if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
             }
         } else if (strcmp(type->valuestring, "system") == 0) {
@@ -600,6 +588,15 @@ void Application::Start() {
             ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
         }
     });
+
+    // Outgoing audio and control messages are written by their own task, see SendControl.
+    // Started once protocol_ is set, the task never sees it change
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->sender_.Run();
+        vTaskDelete(NULL);
+    }, "net_sender", 4096 * 2, this, 3, NULL);
+
     bool protocol_started = protocol_->Start();
 
     SetDeviceState(kDeviceStateIdle);
@@ -617,20 +614,170 @@ void Application::Start() {
     SystemInfo::PrintHeapStats();
 }
 
+void Application::OnTtsMessage(std::string_view state, std::string_view text) {
+    if (state == "start") {
+        // Audio may arrive before the scheduled state change below, keep it until then
+        StartEarlyAudioBuffering();
+        Schedule([this]() {
+            aborted_ = false;
+            if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+            FlushEarlyAudioPackets(device_state_ == kDeviceStateSpeaking);
+        });
+    } else if (state == "stop") {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateSpeaking) {
+                if (listening_mode_ == kListeningModeManualStop) {
+                    SetDeviceState(kDeviceStateIdle);
+                } else {
+                    SetDeviceState(kDeviceStateListening);
+                }
+            }
+        });
+    } else if (state == "sentence_start") {
+        if (text.data() != nullptr) {
+            ESP_LOGI(TAG, "<< %.*s", (int)text.size(), text.data());
+            Schedule([this, message = std::string(text)]() {
+                ShowChatMessage("assistant", message);
+            });
+        }
+    }
+}
+
+void Application::OnSttMessage(std::string_view text) {
+    if (text.data() != nullptr) {
+        ESP_LOGI(TAG, ">> %.*s", (int)text.size(), text.data());
+        Schedule([this, message = std::string(text)]() {
+            ShowChatMessage("user", message);
+        });
+    }
+}
+
+void Application::OnLlmEmotion(std::string_view emotion) {
+    if (emotion.data() == nullptr) {
+        return;
+    }
+    Schedule([this, emotion_str = std::string(emotion)]() {
+        // 更新表情
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetEmotion(emotion_str.c_str());
+
+        // 情绪→灯光映射
+        auto& mcp = McpServer::GetInstance();
+        if (emotion_str == "happy") {
+            // 明亮/活跃灯效：示例取 6（允许范围 3..8）
+            mcp.CallToolLocal(kSwitchLightModeTool, std::string("{\"light_mode\":6}"));
+            // 可选：触发跳舞
+            mcp.CallToolLocal(kDanceTool);
+        } else if (emotion_str == "sad") {
+            // 柔和灯效：示例取 3
+            mcp.CallToolLocal(kSwitchLightModeTool, std::string("{\"light_mode\":3}"));
+        } else if (emotion_str == "angry") {
+            // 强烈灯效：示例取 8
+            mcp.CallToolLocal(kSwitchLightModeTool, std::string("{\"light_mode\":8}"));
+        } else if (emotion_str == "calm" || emotion_str == "neutral") {
+            // 中性/舒缓：示例取 4 或 5
+            mcp.CallToolLocal(kSwitchLightModeTool, std::string("{\"light_mode\":4}"));
+        }
+    });
+}
+
 void Application::OnClockTimer() {
     clock_ticks_++;
 
     auto display = Board::GetInstance().GetDisplay();
     display->UpdateStatusBar();
 
+    // Degrade or restore non-essential work when free memory crosses the watermarks
+    auto& memory_policy = MemoryPolicy::GetInstance();
+    if (memory_policy.Update()) {
+        Schedule([this, level = memory_policy.level()]() {
+            OnMemoryPressureChanged(level);
+        });
+    }
+
+    // Give up on a channel open that hangs, the task in flight is left to finish on its own
+    if (audio_channel_opening_) {
+        Schedule([this]() {
+            if (audio_channel_opening_ && on_audio_channel_ready_ != nullptr &&
+                esp_timer_get_time() - audio_channel_open_time_ > AUDIO_CHANNEL_OPEN_TIMEOUT_MS * 1000LL) {
+                ESP_LOGW(TAG, "Timed out opening audio channel");
+                CancelOpenAudioChannel();
+                Alert(Lang::Strings::ERROR, Lang::Strings::SERVER_TIMEOUT, "sad", Lang::Sounds::P3_EXCLAMATION);
+            }
+        });
+    }
+
+    // The server never answered the utterance, listening with voice processing off would hang forever
+    if (end_of_utterance_time_ != 0) {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateListening && end_of_utterance_time_ != 0 &&
+                esp_timer_get_time() - end_of_utterance_time_ > END_OF_UTTERANCE_RESPONSE_TIMEOUT_MS * 1000LL) {
+                ESP_LOGW(TAG, "No response after end of utterance, closing audio channel");
+                SendControl([this]() {
+                    protocol_->CloseAudioChannel();
+                });
+                SetDeviceState(kDeviceStateIdle);
+            }
+        });
+    }
+
+    // The hello gives one sample per session and includes the server's setup time,
+    // a small MCP ping while the session lasts lets the RTT estimate converge
+    if (clock_ticks_ % RTT_PROBE_INTERVAL_SECONDS == 0 && device_state_ != kDeviceStateIdle) {
+        Schedule([this]() {
+            if (protocol_ && protocol_->IsAudioChannelOpened()) {
+                McpServer::GetInstance().SendPing();
+            }
+        });
+    }
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
         SystemInfo::PrintHeapStats();
+
+        if (protocol_ && device_state_ != kDeviceStateIdle) {
+            auto quality = protocol_->GetLinkQuality();
+            ESP_LOGI(TAG, "Link: rtt %d ms (var %d), loss %.1f%%, tx %lu B/s, rx %lu B/s, send %d ms",
+                quality.rtt_ms, quality.rtt_variation_ms, quality.loss_rate * 100,
+                quality.tx_bytes_per_second, quality.rx_bytes_per_second, quality.send_time_ms);
+        }
+
+        auto tool_stats = McpServer::GetInstance().GetToolCallStats();
+        if (tool_stats.completed > 0 || tool_stats.rejected > 0) {
+            ESP_LOGI(TAG, "Tool calls: %lu done, %lu rejected, max wait %lu ms, max run %lu ms, cache %lu hit / %lu miss",
+                tool_stats.completed, tool_stats.rejected, tool_stats.max_wait_ms, tool_stats.max_run_ms,
+                tool_stats.cache_hits, tool_stats.cache_misses);
+        }
+    }
+}
+
+void Application::OnMemoryPressureChanged(MemoryPressureLevel level) {
+    audio_service_.SetMemoryPressure(level);
+
+    // Show the latest chat message that was deferred
+    if (level == kMemoryPressureNormal && !deferred_chat_message_.empty()) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetChatMessage(deferred_chat_role_.c_str(), deferred_chat_message_.c_str());
+        deferred_chat_role_.clear();
+        deferred_chat_message_.clear();
     }
 }
 
+// Chat bubbles allocate LVGL objects, only keep the latest message while memory is low
+void Application::ShowChatMessage(const std::string& role, const std::string& message) {
+    if (MemoryPolicy::GetInstance().ShouldDeferNonCriticalWork()) {
+        deferred_chat_role_ = role;
+        deferred_chat_message_ = message;
+        return;
+    }
+    auto display = Board::GetInstance().GetDisplay();
+    display->SetChatMessage(role.c_str(), message.c_str());
+}
+
 // Add a async task to MainLoop
 void Application::Schedule(std::function<void()> callback) {
     {
@@ -649,7 +796,6 @@ void Application::MainEventLoop() {
 
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE |
-            MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
@@ -658,14 +804,6 @@ void Application::MainEventLoop() {
             Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (!protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
-        }
-
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
             OnWakeWordDetected();
         }
@@ -688,6 +826,100 @@ void Application::MainEventLoop() {
     }
 }
 
+// Opening the channel connects and waits for the server hello, which can take seconds.
+// It runs in its own task so the main loop keeps handling clock ticks, buttons and aborts.
+// on_ready runs in the main loop when the open finishes, unless it was cancelled first.
+void Application::OpenAudioChannel(std::function<void(bool success)> on_ready) {
+    if (!audio_channel_opening_ && protocol_->IsAudioChannelOpened()) {
+        on_ready(true);
+        return;
+    }
+
+    // A request made while an open is in flight takes over its result
+    on_audio_channel_ready_ = std::move(on_ready);
+    SetDeviceState(kDeviceStateConnecting);
+    if (audio_channel_opening_) {
+        return;
+    }
+
+    audio_channel_opening_ = true;
+    audio_channel_open_time_ = esp_timer_get_time();
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        bool success = app->protocol_->OpenAudioChannel();
+        app->Schedule([app, success]() {
+            app->OnAudioChannelOpenFinished(success);
+        });
+        vTaskDelete(NULL);
+    }, "open_channel", 4096 * 2, this, 2, NULL);
+}
+
+void Application::CancelOpenAudioChannel() {
+    if (!audio_channel_opening_ || on_audio_channel_ready_ == nullptr) {
+        return;
+    }
+    ESP_LOGI(TAG, "Cancel opening audio channel");
+    on_audio_channel_ready_ = nullptr;
+    SetDeviceState(kDeviceStateIdle);
+}
+
+void Application::OnAudioChannelOpenFinished(bool success) {
+    audio_channel_opening_ = false;
+    auto on_ready = std::move(on_audio_channel_ready_);
+    on_audio_channel_ready_ = nullptr;
+
+    if (on_ready == nullptr) {
+        // Cancelled. Close even a failed open, it may have left a connection behind
+        SendControl([this]() {
+            protocol_->CloseAudioChannel();
+        });
+        return;
+    }
+
+    if (!success && device_state_ == kDeviceStateConnecting) {
+        SetDeviceState(kDeviceStateIdle);
+    }
+    on_ready(success);
+}
+
+// Runs callback in the network sender task, ahead of any audio waiting to be sent.
+// Everything that writes to the protocol goes through here, so a slow write never stalls the main loop.
+void Application::SendControl(std::function<void()> callback) {
+    sender_.Post(std::move(callback));
+}
+
+// When the send queue is backed up, the waiting packets go out bundled in one message if the
+// server supports it. A single waiting packet is sent at once, so bundling never adds latency.
+// Returns false if there was nothing to send or the send failed.
+bool Application::SendQueuedAudio() {
+    if (!protocol_) {
+        return false;
+    }
+
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    while (packets.size() < protocol_->max_audio_bundle_frames()) {
+        auto packet = audio_service_.PopPacketFromSendQueue();
+        if (!packet) {
+            break;
+        }
+        packets.push_back(std::move(packet));
+    }
+    if (packets.empty()) {
+        return false;
+    }
+
+    return packets.size() == 1 ? protocol_->SendAudio(std::move(packets.front()))
+                               : protocol_->SendAudioBundle(packets);
+}
+
+// Control tasks run before queued audio, so a task that ends the utterance sends the
+// audio already encoded first, otherwise the end of the utterance is cut off.
+// Runs on the sender task.
+void Application::FlushQueuedAudio() {
+    while (SendQueuedAudio()) {
+    }
+}
+
 void Application::OnWakeWordDetected() {
     if (!protocol_) {
         return;
@@ -696,40 +928,83 @@ void Application::OnWakeWordDetected() {
     if (device_state_ == kDeviceStateIdle) {
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+        OpenAudioChannel([this](bool success) {
+            if (!success) {
                 audio_service_.EnableWakeWordDetection(true);
                 return;
             }
-        }
 
-        auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+            auto wake_word = audio_service_.GetLastWakeWord();
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            SendControl([this, wake_word]() {
+                // Encode and send the wake word data to the server
+                while (auto packet = audio_service_.PopWakeWordPacket()) {
+                    protocol_->SendAudio(std::move(packet));
+                }
+                // Set the chat state to wake word detected
+                protocol_->SendWakeWordDetected(wake_word);
+            });
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-        // Play the pop up sound to indicate the wake word is detected
-        audio_service_.PlaySound(Lang::Sounds::P3_POPUP);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Play the pop up sound to indicate the wake word is detected
+            audio_service_.PlaySound(Lang::Sounds::P3_POPUP);
 #endif
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonWakeWordDetected);
+    } else if (device_state_ == kDeviceStateConnecting) {
+        CancelOpenAudioChannel();
     } else if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
     }
 }
 
+// The local endpointer detected the end of the user's utterance in auto stop mode.
+// Stop uploading audio right away instead of waiting for the server VAD.
+void Application::OnEndOfUtterance() {
+    if (device_state_ != kDeviceStateListening || listening_mode_ != kListeningModeAutoStop) {
+        return;
+    }
+
+    // Send the audio already encoded before the stop command
+    SendControl([this]() {
+        FlushQueuedAudio();
+        protocol_->SendStopListening();
+    });
+    audio_service_.EnableVoiceProcessing(false);
+    end_of_utterance_time_ = esp_timer_get_time();
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
-    protocol_->SendAbortSpeaking(reason);
+    FlushEarlyAudioPackets(false);
+    SendControl([this, reason]() {
+        protocol_->SendAbortSpeaking(reason);
+    });
+}
+
+void Application::OnIncomingAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!early_audio_.Offer(packet) && device_state_ == kDeviceStateSpeaking) {
+        audio_service_.PushPacketToDecodeQueue(std::move(packet));
+    }
+}
+
+void Application::StartEarlyAudioBuffering() {
+    if (device_state_ == kDeviceStateSpeaking) {
+        return;
+    }
+    early_audio_.Start(protocol_->session_id());
+}
+
+// Push the early audio packets to the decode queue if play is true, otherwise discard them.
+// Packets from an older session are always discarded.
+void Application::FlushEarlyAudioPackets(bool play) {
+    early_audio_.Flush(play && !aborted_, protocol_->session_id(), [this](std::unique_ptr<AudioStreamPacket> packet) {
+        return audio_service_.PushPacketToDecodeQueue(std::move(packet));
+    });
 }
 
 void Application::SetListeningMode(ListeningMode mode) {
@@ -743,6 +1018,7 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    end_of_utterance_time_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -774,7 +1050,10 @@ void Application::SetDeviceState(DeviceState state) {
             // Make sure the audio processor is running
             if (!audio_service_.IsAudioProcessorRunning()) {
                 // Send the start listening command
-                protocol_->SendStartListening(listening_mode_);
+                SendControl([this, mode = listening_mode_]() {
+                    protocol_->SendStartListening(mode);
+                });
+                audio_service_.EnableEndpointer(listening_mode_ == kListeningModeAutoStop);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
             }
@@ -792,6 +1071,7 @@ void Application::SetDeviceState(DeviceState state) {
 #endif
             }
             audio_service_.ResetDecoder();
+            FlushEarlyAudioPackets(true);
             break;
         default:
             // Do nothing
@@ -806,19 +1086,28 @@ void Application::Reboot() {
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
     if (device_state_ == kDeviceStateIdle) {
-        ToggleChatState();
+        if (!protocol_) {
+            ESP_LOGE(TAG, "Protocol not initialized");
+            return;
+        }
         Schedule([this, wake_word]() {
-            if (protocol_) {
-                protocol_->SendWakeWordDetected(wake_word); 
-            }
-        }); 
+            OpenAudioChannel([this, wake_word](bool success) {
+                if (success) {
+                    SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                    SendControl([this, wake_word]() {
+                        protocol_->SendWakeWordDetected(wake_word);
+                    });
+                }
+            });
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
     } else if (device_state_ == kDeviceStateListening) {   
-        Schedule([this]() {
+        SendControl([this]() {
             if (protocol_) {
+                FlushQueuedAudio();
                 protocol_->CloseAudioChannel();
             }
         });
@@ -830,7 +1119,7 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+    if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
         return false;
     }
 
@@ -842,8 +1131,8 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
-    Schedule([this, payload]() {
+void Application::SendMcpMessage(std::string payload) {
+    SendControl([this, payload = std::move(payload)]() {
         if (protocol_) {
             protocol_->SendMcpMessage(payload);
         }
@@ -871,8 +1160,10 @@ void Application::SetAecMode(AecMode mode) {
         }
 
         // If the AEC mode is changed, close the audio channel
-        if (protocol_ && protocol_->IsAudioChannelOpened()) {
-            protocol_->CloseAudioChannel();
+        if (protocol_ && !audio_channel_opening_ && protocol_->IsAudioChannelOpened()) {
+            SendControl([this]() {
+                protocol_->CloseAudioChannel();
+            });
         }
     });
 }
@@ -7,24 +7,37 @@
 #include <esp_timer.h>
 
 #include <string>
+#include <string_view>
 #include <mutex>
 #include <deque>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
+#include "early_audio_buffer.h"
+#include "network_sender.h"
 #include "device_state_event.h"
 #include "dice_controller.h"
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
-#define MAIN_EVENT_SEND_AUDIO (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE (1 << 3)
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 
+// Backstop for a channel open that hangs inside the network stack
+#define AUDIO_CHANNEL_OPEN_TIMEOUT_MS 20000
+// Back to idle if the server does not answer after a local end of utterance
+#define END_OF_UTTERANCE_RESPONSE_TIMEOUT_MS 15000
+// RTT probe interval while a session is active
+#define RTT_PROBE_INTERVAL_SECONDS 5
+
+// TTS audio received after "tts start" but before the Speaking state is entered
+#define MAX_EARLY_AUDIO_PACKETS (1200 / OPUS_FRAME_DURATION_MS)
+
 enum AecMode {
     kAecOff,
     kAecOnDeviceSide,
@@ -56,7 +69,10 @@ public:
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
+    // Runs callback in the network sender task, see NetworkSender. Protocols use it for
+    // writes they start themselves, e.g. a keepalive or closing on a server goodbye
+    void SendControl(std::function<void()> callback);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
@@ -78,6 +94,8 @@ private:
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
+    // Network sender task, control messages are sent before queued audio
+    NetworkSender sender_{[this]() { return SendQueuedAudio(); }};
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     ListeningMode listening_mode_ = kListeningModeAutoStop;
     AecMode aec_mode_ = kAecOff;
@@ -88,15 +106,44 @@ private:
     bool aborted_ = false;
     int clock_ticks_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
+
+    // Audio channel open in flight, see OpenAudioChannel. Also read by the clock timer
+    std::atomic<bool> audio_channel_opening_ = false;
+    int64_t audio_channel_open_time_ = 0;
+    std::function<void(bool success)> on_audio_channel_ready_;
+
+    // Set when the local endpointer stops listening, 0 once the state changes. Read by the clock timer
+    std::atomic<int64_t> end_of_utterance_time_ = 0;
     
+    // Early TTS audio, buffered until the Speaking state is entered
+    EarlyAudioBuffer early_audio_{MAX_EARLY_AUDIO_PACKETS};
+
+    // Chat message deferred while memory is low
+    std::string deferred_chat_role_;
+    std::string deferred_chat_message_;
+
     // 骰子相关状态
     int last_dice_result_ = 0;  // 最后一次骰子结果 (1-6, 0表示未投掷)
 
     void OnWakeWordDetected();
+    void OpenAudioChannel(std::function<void(bool success)> on_ready);
+    void CancelOpenAudioChannel();
+    void OnAudioChannelOpenFinished(bool success);
+    bool SendQueuedAudio();
+    void FlushQueuedAudio();
+    void OnEndOfUtterance();
+    void OnMemoryPressureChanged(MemoryPressureLevel level);
+    void ShowChatMessage(const std::string& role, const std::string& message);
     void CheckNewVersion(Ota& ota);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
+    void OnIncomingAudio(std::unique_ptr<AudioStreamPacket> packet);
+    void OnTtsMessage(std::string_view state, std::string_view text);
+    void OnSttMessage(std::string_view text);
+    void OnLlmEmotion(std::string_view emotion);
+    void StartEarlyAudioBuffering();
+    void FlushEarlyAudioPackets(bool play);
 };
 
 #endif // _APPLICATION_H_
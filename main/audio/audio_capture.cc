@@ -0,0 +1,95 @@
+#include "audio_capture.h"
+
+void AudioCaptureFrame::Reset(int channels) {
+    channels_ = channels;
+    mic_data_ready_ = false;
+}
+
+const std::vector<int16_t>& AudioCaptureFrame::GetSamples(bool mic_only) {
+    if (!mic_only || channels_ == 1) {
+        return data_;
+    }
+    if (!mic_data_ready_) {
+        mic_data_.resize(data_.size() / channels_);
+        for (size_t i = 0, j = 0; i < mic_data_.size(); ++i, j += channels_) {
+            mic_data_[i] = data_[j];
+        }
+        mic_data_ready_ = true;
+    }
+    return mic_data_;
+}
+
+void AudioCapture::Initialize(int input_channels) {
+    input_channels_ = input_channels;
+}
+
+void AudioCapture::AddConsumer(const char* name, uint32_t active_bits, bool mic_only,
+    std::function<size_t()> get_feed_size, std::function<void(const std::vector<int16_t>& data)> on_data) {
+    consumers_.push_back(AudioCaptureConsumer{
+        .name = name,
+        .active_bits = active_bits,
+        .mic_only = mic_only,
+        .get_feed_size = get_feed_size,
+        .on_data = on_data,
+        .pending = {},
+    });
+}
+
+size_t AudioCapture::GetBlockSamples(uint32_t bits) {
+    size_t block_samples = 0;
+    for (auto& consumer : consumers_) {
+        if ((consumer.active_bits & bits) == 0) {
+            continue;
+        }
+        size_t feed_size = consumer.get_feed_size();
+        if (!consumer.mic_only) {
+            feed_size /= input_channels_;
+        }
+        if (feed_size > 0 && (block_samples == 0 || feed_size < block_samples)) {
+            block_samples = feed_size;
+        }
+    }
+    return block_samples;
+}
+
+AudioCaptureFramePtr AudioCapture::AcquireFrame() {
+    // Reuse the previous frame if no consumer holds it any more
+    if (frame_ == nullptr || frame_.use_count() > 1) {
+        frame_ = std::make_shared<AudioCaptureFrame>();
+    }
+    frame_->Reset(input_channels_);
+    return frame_;
+}
+
+void AudioCapture::Dispatch(const AudioCaptureFramePtr& frame, uint32_t bits) {
+    for (auto& consumer : consumers_) {
+        if ((consumer.active_bits & bits) == 0) {
+            // Drop stale samples so the consumer starts fresh when it is enabled again
+            consumer.pending.clear();
+            continue;
+        }
+
+        size_t feed_size = consumer.get_feed_size();
+        if (feed_size == 0) {
+            continue;
+        }
+
+        auto& samples = frame->GetSamples(consumer.mic_only);
+        if (samples.size() == feed_size && consumer.pending.empty()) {
+            consumer.on_data(samples);
+            continue;
+        }
+
+        consumer.pending.insert(consumer.pending.end(), samples.begin(), samples.end());
+        while (consumer.pending.size() >= feed_size) {
+            if (consumer.pending.size() == feed_size) {
+                consumer.on_data(consumer.pending);
+                consumer.pending.clear();
+            } else {
+                std::vector<int16_t> data(consumer.pending.begin(), consumer.pending.begin() + feed_size);
+                consumer.pending.erase(consumer.pending.begin(), consumer.pending.begin() + feed_size);
+                consumer.on_data(data);
+            }
+        }
+    }
+}
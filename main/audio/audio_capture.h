@@ -0,0 +1,61 @@
+#ifndef AUDIO_CAPTURE_H
+#define AUDIO_CAPTURE_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/*
+ * One block of 16kHz PCM read from the codec, shared by reference between all consumers.
+ * The mic channel of a multi-channel block is extracted at most once, on first use.
+ */
+class AudioCaptureFrame {
+public:
+    void Reset(int channels);
+    const std::vector<int16_t>& GetSamples(bool mic_only);
+
+    inline std::vector<int16_t>& data() { return data_; }
+    inline int channels() const { return channels_; }
+
+private:
+    std::vector<int16_t> data_;
+    std::vector<int16_t> mic_data_;
+    int channels_ = 1;
+    bool mic_data_ready_ = false;
+};
+
+using AudioCaptureFramePtr = std::shared_ptr<AudioCaptureFrame>;
+
+struct AudioCaptureConsumer {
+    const char* name;
+    uint32_t active_bits;   // The consumer runs while any of these bits is set
+    bool mic_only;          // Only the mic channel instead of all input channels
+    std::function<size_t()> get_feed_size;  // Samples per feed, in the consumer's channel view
+    std::function<void(const std::vector<int16_t>& data)> on_data;
+    std::vector<int16_t> pending;   // Used only when the feed size differs from the block size
+};
+
+/*
+ * Reads the codec once per block and fans the block out to all active consumers.
+ * The block size is the smallest feed size of the active consumers, so the common case
+ * (all consumers use the same feed size) hands the same buffer to every consumer without copies.
+ */
+class AudioCapture {
+public:
+    void Initialize(int input_channels);
+    void AddConsumer(const char* name, uint32_t active_bits, bool mic_only,
+        std::function<size_t()> get_feed_size, std::function<void(const std::vector<int16_t>& data)> on_data);
+
+    // Samples per channel to read for the next block, 0 if no consumer is active
+    size_t GetBlockSamples(uint32_t bits);
+    AudioCaptureFramePtr AcquireFrame();
+    void Dispatch(const AudioCaptureFramePtr& frame, uint32_t bits);
+
+private:
+    int input_channels_ = 1;
+    std::vector<AudioCaptureConsumer> consumers_;
+    AudioCaptureFramePtr frame_;
+};
+
+#endif // AUDIO_CAPTURE_H
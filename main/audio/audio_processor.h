@@ -12,7 +12,7 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms) = 0;
-    virtual void Feed(std::vector<int16_t>&& data) = 0;
+    virtual void Feed(const std::vector<int16_t>& data) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
@@ -20,6 +20,8 @@ public:
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
+    // Feed() takes only the mic channel instead of all input channels
+    virtual bool FeedMicChannelOnly() const { return false; }
 };
 
 #endif
@@ -1,5 +1,7 @@
 #include "audio_service.h"
 #include <esp_log.h>
+#include <algorithm>
+#include "audio_packet_pool.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -17,6 +19,11 @@
 
 #define TAG "AudioService"
 
+// Opus can decode any packet directly to one of these rates, no matter what rate it was encoded at
+static bool IsOpusSampleRate(int sample_rate) {
+    return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 ||
+        sample_rate == 24000 || sample_rate == 48000;
+}
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
@@ -34,7 +41,13 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
+    if (IsOpusSampleRate(codec->output_sample_rate())) {
+        // Decode straight to the speaker rate, so no output resampling is needed
+        opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
+    } else {
+        opus_decoder_ = std::make_unique<OpusDecoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+        output_resampler_.Configure(16000, codec->output_sample_rate());
+    }
     opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
     opus_encoder_->SetComplexity(0);
 
@@ -59,7 +72,34 @@ void AudioService::Initialize(AudioCodec* codec) {
     wake_word_ = nullptr;
 #endif
 
+#if CONFIG_USE_LOCAL_ENDPOINTER
+    endpointer_.Configure(CONFIG_LOCAL_ENDPOINTER_TRAILING_SILENCE_MS, CONFIG_LOCAL_ENDPOINTER_MAX_UTTERANCE_MS);
+#endif
+
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
+        if (endpointer_enabled_) {
+            // Stop encoding once the utterance has ended
+            if (endpointer_.triggered()) {
+                return;
+            }
+            if (endpointer_.Feed(voice_detected_, OPUS_FRAME_DURATION_MS)) {
+                ESP_LOGI(TAG, "End of utterance detected after %d ms", endpointer_.utterance_ms());
+                // Frames still waiting to be encoded would reach the server after "listen stop",
+                // they are trailing silence, drop them
+                end_of_utterance_ = true;
+                {
+                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+                    audio_encode_queue_.erase(std::remove_if(audio_encode_queue_.begin(), audio_encode_queue_.end(),
+                        [](const std::unique_ptr<AudioTask>& task) {
+                            return task->type == kAudioTaskTypeEncodeToSendQueue;
+                        }), audio_encode_queue_.end());
+                    audio_queue_cv_.notify_all();
+                }
+                if (callbacks_.on_end_of_utterance) {
+                    callbacks_.on_end_of_utterance();
+                }
+            }
+        }
         PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
     });
 
@@ -70,6 +110,26 @@ void AudioService::Initialize(AudioCodec* codec) {
         }
     });
 
+    /* All mic consumers share one codec read per block */
+    audio_capture_.Initialize(codec->input_channels());
+    audio_capture_.AddConsumer("audio_testing", AS_EVENT_AUDIO_TESTING_RUNNING, true,
+        []() -> size_t { return OPUS_FRAME_DURATION_MS * 16000 / 1000; },
+        [this](const std::vector<int16_t>& data) {
+            PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::vector<int16_t>(data));
+        });
+    if (wake_word_) {
+        audio_capture_.AddConsumer("wake_word", AS_EVENT_WAKE_WORD_RUNNING, wake_word_->FeedMicChannelOnly(),
+            [this]() { return wake_word_->GetFeedSize(); },
+            [this](const std::vector<int16_t>& data) {
+                wake_word_->Feed(data);
+            });
+    }
+    audio_capture_.AddConsumer("audio_processor", AS_EVENT_AUDIO_PROCESSOR_RUNNING, audio_processor_->FeedMicChannelOnly(),
+        [this]() { return audio_processor_->GetFeedSize(); },
+        [this](const std::vector<int16_t>& data) {
+            audio_processor_->Feed(data);
+        });
+
     if (wake_word_) {
         wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
             if (callbacks_.on_wake_word_detected) {
@@ -226,43 +286,15 @@ void AudioService::AudioInputTask() {
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
-                }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
-                continue;
-            }
         }
 
-        /* Feed the wake word */
-        if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = wake_word_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
-                    continue;
-                }
-            }
-        }
-
-        /* Feed the audio processor */
-        if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = audio_processor_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
-                    continue;
-                }
+        /* Read one block and hand it to every running consumer (testing, wake word, processor) */
+        size_t block_samples = audio_capture_.GetBlockSamples(bits);
+        if (block_samples > 0) {
+            auto frame = audio_capture_.AcquireFrame();
+            if (ReadAudioData(frame->data(), 16000, block_samples * codec_->input_channels())) {
+                audio_capture_.Dispatch(frame, bits);
+                continue;
             }
         }
 
@@ -313,7 +345,7 @@ void AudioService::OpusCodecTask() {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
         audio_queue_cv_.wait(lock, [this]() {
             return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
+                (!audio_encode_queue_.empty() && audio_send_queue_.size() < max_send_packets_) ||
                 (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
         });
         if (service_stopped_) {
@@ -332,7 +364,10 @@ void AudioService::OpusCodecTask() {
             task->timestamp = packet->timestamp;
 
             SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
+            bool decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+            // Hand the packet storage back to the protocols for the next received frame
+            AudioPacketPool::GetInstance().Release(std::move(packet));
+            if (decoded) {
                 // Resample if the sample rate is different
                 if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
                     int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
@@ -352,7 +387,7 @@ void AudioService::OpusCodecTask() {
         }
         
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
+        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < max_send_packets_) {
             auto task = std::move(audio_encode_queue_.front());
             audio_encode_queue_.pop_front();
             audio_queue_cv_.notify_all();
@@ -367,7 +402,10 @@ void AudioService::OpusCodecTask() {
                 continue;
             }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            if (task->type == kAudioTaskTypeEncodeToSendQueue && end_of_utterance_) {
+                // The frame was being encoded when the utterance ended, see OnOutput
+                ESP_LOGD(TAG, "Dropping frame encoded after end of utterance");
+            } else if (task->type == kAudioTaskTypeEncodeToSendQueue) {
                 {
                     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
                     audio_send_queue_.push_back(std::move(packet));
@@ -388,17 +426,26 @@ void AudioService::OpusCodecTask() {
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+    // If the codec runs at an Opus rate, the decoder stays at that rate for every packet
+    // and the packet sample rate only matters for non-Opus codec rates.
+    int decode_sample_rate = sample_rate;
+    if (IsOpusSampleRate(codec_->output_sample_rate())) {
+        decode_sample_rate = codec_->output_sample_rate();
+    }
+
+    // The decoder output is sized to its configured frame, so the frame duration must match exactly,
+    // otherwise shorter packets would be padded with samples that were never decoded
+    if (opus_decoder_->sample_rate() == decode_sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
     }
 
+    ESP_LOGI(TAG, "Create opus decoder: %d Hz, %d ms", decode_sample_rate, frame_duration);
     opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate, 1, frame_duration);
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec_->output_sample_rate());
+        output_resampler_.Configure(opus_decoder_->sample_rate(), codec_->output_sample_rate());
     }
 }
 
@@ -427,9 +474,9 @@ void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
+    if (audio_decode_queue_.size() >= max_decode_packets_) {
         if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
+            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < max_decode_packets_; });
         } else {
             return false;
         }
@@ -500,6 +547,8 @@ void AudioService::EnableVoiceProcessing(bool enable) {
 
         /* We should make sure no audio is playing */
         ResetDecoder();
+        endpointer_.Reset();
+        end_of_utterance_ = false;
         audio_input_need_warmup_ = true;
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
@@ -532,6 +581,51 @@ void AudioService::EnableDeviceAec(bool enable) {
     audio_processor_->EnableDeviceAec(enable);
 }
 
+void AudioService::EnableEndpointer(bool enable) {
+#if CONFIG_USE_LOCAL_ENDPOINTER
+    endpointer_enabled_ = enable;
+    end_of_utterance_ = false;
+#else
+    endpointer_enabled_ = false;
+#endif
+}
+
+void AudioService::SetMemoryPressure(MemoryPressureLevel level) {
+    size_t divisor = 1;
+    if (level == kMemoryPressureLow) {
+        divisor = LOW_MEMORY_QUEUE_DIVISOR;
+    } else if (level == kMemoryPressureCritical) {
+        divisor = CRITICAL_MEMORY_QUEUE_DIVISOR;
+    }
+    int pcm_history_duration_ms = MemoryPolicy::GetWakeWordHistoryMs(level);
+    if (level == kMemoryPressureCritical) {
+        AudioPacketPool::GetInstance().Clear();
+    }
+
+    if (wake_word_) {
+        wake_word_->SetPcmHistoryDuration(pcm_history_duration_ms);
+    }
+
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    max_decode_packets_ = std::max<size_t>(1, MAX_DECODE_PACKETS_IN_QUEUE / divisor);
+    max_send_packets_ = std::max<size_t>(1, MAX_SEND_PACKETS_IN_QUEUE / divisor);
+
+    // Lowering a limit frees the packets over it right away, the oldest go first
+    size_t dropped_decode = 0;
+    while (audio_decode_queue_.size() > max_decode_packets_) {
+        audio_decode_queue_.pop_front();
+        dropped_decode++;
+    }
+    size_t dropped_send = 0;
+    while (audio_send_queue_.size() > max_send_packets_) {
+        audio_send_queue_.pop_front();
+        dropped_send++;
+    }
+    ESP_LOGI(TAG, "Queue limits: decode %u (dropped %u), send %u (dropped %u), wake word history %d ms",
+        max_decode_packets_, dropped_decode, max_send_packets_, dropped_send, pcm_history_duration_ms);
+    audio_queue_cv_.notify_all();
+}
+
 void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -18,9 +19,12 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_capture.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
+#include "endpointer.h"
 #include "protocol.h"
+#include "memory_policy.h"
 
 
 /*
@@ -39,6 +43,9 @@
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
 #define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Under memory pressure each queue limit is divided by these
+#define LOW_MEMORY_QUEUE_DIVISOR 2
+#define CRITICAL_MEMORY_QUEUE_DIVISOR 5
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
 
@@ -56,6 +63,7 @@ struct AudioServiceCallbacks {
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    std::function<void(void)> on_end_of_utterance;
 };
 
 
@@ -98,6 +106,8 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    void EnableEndpointer(bool enable);
+    void SetMemoryPressure(MemoryPressureLevel level);
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
@@ -119,6 +129,8 @@ private:
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
     DebugStatistics debug_statistics_;
+    AudioCapture audio_capture_;
+    Endpointer endpointer_;
 
     EventGroupHandle_t event_group_;
 
@@ -133,6 +145,8 @@ private:
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    size_t max_decode_packets_ = MAX_DECODE_PACKETS_IN_QUEUE;
+    size_t max_send_packets_ = MAX_SEND_PACKETS_IN_QUEUE;
     // For server AEC
     std::deque<uint32_t> timestamp_queue_;
 
@@ -141,6 +155,9 @@ private:
     bool voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
+    // Set on the main loop, read by the audio processor and the opus codec task
+    std::atomic<bool> endpointer_enabled_ = false;
+    std::atomic<bool> end_of_utterance_ = false;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
@@ -0,0 +1,57 @@
+#include "early_audio_buffer.h"
+
+#include <esp_log.h>
+
+#define TAG "EarlyAudio"
+
+void EarlyAudioBuffer::Start(const std::string& session_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    packets_.clear();
+    session_id_ = session_id;
+    buffering_ = true;
+}
+
+bool EarlyAudioBuffer::Offer(std::unique_ptr<AudioStreamPacket>& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!buffering_) {
+        return false;
+    }
+    if (packets_.size() >= max_packets_) {
+        dropped_count_++;
+    } else {
+        packets_.push_back(std::move(packet));
+    }
+    return true;
+}
+
+void EarlyAudioBuffer::Flush(bool play, const std::string& session_id, const PushCallback& push) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!buffering_) {
+        return;
+    }
+    buffering_ = false;
+    if (packets_.empty()) {
+        return;
+    }
+
+    play = play && session_id_ == session_id;
+    for (auto& packet : packets_) {
+        if (play && push(std::move(packet))) {
+            saved_count_++;
+        } else {
+            dropped_count_++;
+        }
+    }
+    packets_.clear();
+    ESP_LOGI(TAG, "Early audio packets: %lu saved, %lu dropped", saved_count_, dropped_count_);
+}
+
+uint32_t EarlyAudioBuffer::saved_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return saved_count_;
+}
+
+uint32_t EarlyAudioBuffer::dropped_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_count_;
+}
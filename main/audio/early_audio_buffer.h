@@ -0,0 +1,48 @@
+#ifndef EARLY_AUDIO_BUFFER_H
+#define EARLY_AUDIO_BUFFER_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+/*
+ * TTS audio that arrives after "tts start" but before the Speaking state is entered.
+ *
+ * Start() is called when "tts start" is received on the network task, Offer() for every
+ * incoming packet and Flush() once the state change has run on the main loop. A packet
+ * offered after Flush() returned is never buffered, so the caller pushing it to the
+ * decode queue keeps the packets in order.
+ */
+class EarlyAudioBuffer {
+public:
+    using PushCallback = std::function<bool(std::unique_ptr<AudioStreamPacket> packet)>;
+
+    explicit EarlyAudioBuffer(size_t max_packets) : max_packets_(max_packets) {}
+
+    void Start(const std::string& session_id);
+    // Returns true if the packet was taken (buffered, or dropped because the buffer is full)
+    bool Offer(std::unique_ptr<AudioStreamPacket>& packet);
+    // Stops buffering. The packets are pushed if play is true and they belong to session_id,
+    // otherwise they are discarded
+    void Flush(bool play, const std::string& session_id, const PushCallback& push);
+
+    uint32_t saved_count();
+    uint32_t dropped_count();
+
+private:
+    std::mutex mutex_;
+    size_t max_packets_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> packets_;
+    std::string session_id_;
+    bool buffering_ = false;
+    uint32_t saved_count_ = 0;
+    uint32_t dropped_count_ = 0;
+};
+
+#endif // EARLY_AUDIO_BUFFER_H
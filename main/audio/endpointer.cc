@@ -0,0 +1,39 @@
+#include "endpointer.h"
+
+void Endpointer::Configure(int trailing_silence_ms, int max_utterance_ms) {
+    trailing_silence_ms_ = trailing_silence_ms;
+    max_utterance_ms_ = max_utterance_ms;
+    Reset();
+}
+
+void Endpointer::Reset() {
+    speech_started_ = false;
+    triggered_ = false;
+    utterance_ms_ = 0;
+    silence_ms_ = 0;
+}
+
+bool Endpointer::Feed(bool voice_detected, int frame_duration_ms) {
+    if (triggered_) {
+        return false;
+    }
+
+    if (!speech_started_) {
+        if (!voice_detected) {
+            return false;
+        }
+        speech_started_ = true;
+    }
+
+    utterance_ms_ += frame_duration_ms;
+    if (voice_detected) {
+        silence_ms_ = 0;
+    } else {
+        silence_ms_ += frame_duration_ms;
+    }
+
+    if (silence_ms_ >= trailing_silence_ms_ || utterance_ms_ >= max_utterance_ms_) {
+        triggered_ = true;
+    }
+    return triggered_;
+}
@@ -0,0 +1,32 @@
+#ifndef ENDPOINTER_H
+#define ENDPOINTER_H
+
+/*
+ * Local end-of-utterance detection based on the VAD state of the audio processor.
+ *
+ * The utterance ends when, after some speech has been detected, either
+ * 1. the trailing silence lasts longer than trailing_silence_ms, or
+ * 2. the utterance (from the first speech frame) lasts longer than max_utterance_ms.
+ */
+class Endpointer {
+public:
+    void Configure(int trailing_silence_ms, int max_utterance_ms);
+    void Reset();
+
+    // Feed the VAD state of one frame, returns true only for the frame that ends the utterance
+    bool Feed(bool voice_detected, int frame_duration_ms);
+
+    inline bool triggered() const { return triggered_; }
+    inline int utterance_ms() const { return utterance_ms_; }
+
+private:
+    int trailing_silence_ms_ = 800;
+    int max_utterance_ms_ = 15000;
+
+    bool speech_started_ = false;
+    bool triggered_ = false;
+    int utterance_ms_ = 0;
+    int silence_ms_ = 0;
+};
+
+#endif // ENDPOINTER_H
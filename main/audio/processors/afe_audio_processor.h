@@ -19,7 +19,7 @@ public:
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
-    void Feed(std::vector<int16_t>&& data) override;
+    void Feed(const std::vector<int16_t>& data) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
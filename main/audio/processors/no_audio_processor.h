@@ -13,7 +13,7 @@ public:
     ~NoAudioProcessor() = default;
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
-    void Feed(std::vector<int16_t>&& data) override;
+    void Feed(const std::vector<int16_t>& data) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
@@ -21,6 +21,7 @@ public:
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    bool FeedMicChannelOnly() const override { return true; }
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -20,6 +20,10 @@ public:
     virtual void EncodeWakeWordData() = 0;
     virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
+    // Feed() takes only the mic channel instead of all input channels
+    virtual bool FeedMicChannelOnly() const { return false; }
+    // Limit the PCM history kept for EncodeWakeWordData()
+    virtual void SetPcmHistoryDuration(int duration_ms) {}
 };
 
 #endif
@@ -145,8 +145,8 @@ void AfeWakeWord::AudioDetectionTask() {
 void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
     // store audio data to wake_word_pcm_
     wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
+    // keep about 2 seconds of data (less under memory pressure), detect duration is 30ms (sample_rate == 16000, chunksize == 512)
+    while (wake_word_pcm_.size() > pcm_history_duration_ms_ / 30) {
         wake_word_pcm_.pop_front();
     }
 }
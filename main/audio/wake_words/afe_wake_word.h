@@ -15,6 +15,7 @@
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include "audio_codec.h"
 #include "wake_word.h"
@@ -33,6 +34,7 @@ public:
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    void SetPcmHistoryDuration(int duration_ms) { pcm_history_duration_ms_ = duration_ms; }
 
 private:
     srmodel_list_t *models_ = nullptr;
@@ -49,6 +51,7 @@ private:
     StaticTask_t* wake_word_encode_task_buffer_ = nullptr;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
     std::deque<std::vector<int16_t>> wake_word_pcm_;
+    std::atomic<int> pcm_history_duration_ms_ = 2000;  // Set from the main loop under memory pressure
     std::deque<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
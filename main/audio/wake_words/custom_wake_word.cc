@@ -80,20 +80,9 @@ void CustomWakeWord::Feed(const std::vector<int16_t>& data) {
         return;
     }
 
-    esp_mn_state_t mn_state;
-    // If input channels is 2, we need to fetch the left channel data
-    if (codec_->input_channels() == 2) {
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-
-        StoreWakeWordData(mono_data);
-        mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(mono_data.data()));
-    } else {
-        StoreWakeWordData(data);
-        mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(data.data()));
-    }
+    // Only the mic channel is fed, see FeedMicChannelOnly()
+    StoreWakeWordData(data);
+    esp_mn_state_t mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(data.data()));
     
     if (mn_state == ESP_MN_STATE_DETECTING) {
         return;
@@ -121,14 +110,14 @@ size_t CustomWakeWord::GetFeedSize() {
     if (multinet_model_data_ == nullptr) {
         return 0;
     }
-    return multinet_->get_samp_chunksize(multinet_model_data_) * codec_->input_channels();
+    return multinet_->get_samp_chunksize(multinet_model_data_);
 }
 
 void CustomWakeWord::StoreWakeWordData(const std::vector<int16_t>& data) {
     // store audio data to wake_word_pcm_
     wake_word_pcm_.push_back(data);
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
+    // keep about 2 seconds of data (less under memory pressure), detect duration is 30ms (sample_rate == 16000, chunksize == 512)
+    while (wake_word_pcm_.size() > pcm_history_duration_ms_ / 30) {
         wake_word_pcm_.pop_front();
     }
 }
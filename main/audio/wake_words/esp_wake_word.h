@@ -27,6 +27,7 @@ public:
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    bool FeedMicChannelOnly() const { return true; }
 
 private:
     esp_wn_iface_t *wakenet_iface_ = nullptr;
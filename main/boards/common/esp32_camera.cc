@@ -3,6 +3,7 @@
 #include "display.h"
 #include "board.h"
 #include "system_info.h"
+#include "memory_policy.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
@@ -112,6 +113,12 @@ bool Esp32Camera::Capture() {
         ESP_LOGE(TAG, "Preview image data is not initialized");
         return true;
     }
+    // 内存紧张时跳过预览，图像仍可上传
+    if (MemoryPolicy::GetInstance().ShouldDeferNonCriticalWork()) {
+        ESP_LOGW(TAG, "Skip preview because of memory pressure");
+        return true;
+    }
+
     // 显示预览图片
     auto display = Board::GetInstance().GetDisplay();
     if (display != nullptr) {
@@ -4,6 +4,7 @@
  */
 
 #include "bocha_search.h"
+#include "json_arena.h"
 #include <esp_log.h>
 #include <esp_http_client.h>
 #include <cJSON.h>
@@ -20,6 +21,7 @@
 #define HTTP_TIMEOUT_MS 30000  // 30 秒超时
 #define MAX_RETRIES 3          // 最大重试次数
 #define RETRY_DELAY_MS 1000    // 重试间隔
+#define SEARCH_CACHE_TTL_MS 60000  // 搜索结果缓存 60 秒
 
 // HTTP 事件处理器数据结构
 struct http_event_data {
@@ -47,7 +49,8 @@ void BochaSearch::RegisterTools() {
             Property("query", kPropertyTypeString),  // 必填参数
             Property("count", kPropertyTypeInteger, 2, 1, 4)  // 可选参数，默认值2，范围1-4
         }),
-        DoSearch
+        DoSearch,
+        kMcpToolStackLarge
     );
 
     // 添加专门的服装搜索工具
@@ -72,9 +75,14 @@ void BochaSearch::RegisterTools() {
             Property("item_type", kPropertyTypeString, ""),
             Property("count", kPropertyTypeInteger, 3, 1, 4)
         }),
-        DoOutfitSearch
+        DoOutfitSearch,
+        kMcpToolStackLarge
     );
 
+    // 相同的搜索参数短时间内不再重复发起 HTTP 请求
+    mcp_server.SetToolCacheTtl("self.search.bocha", SEARCH_CACHE_TTL_MS);
+    mcp_server.SetToolCacheTtl("self.search.outfit", SEARCH_CACHE_TTL_MS);
+
     ESP_LOGI(TAG, "Bocha AI search tool registered successfully");
 }
 
@@ -263,6 +271,9 @@ std::string BochaSearch::HttpPost(const std::string& payload) {
 
 std::string BochaSearch::ParseSearchResults(const std::string& json_content) {
     ESP_LOGD(TAG, "Parsing JSON response (%zu bytes)", json_content.length());
+    // 搜索响应可达数十 KB，整棵 cJSON 树放在一个 arena 中，函数返回时一次释放。
+    // 结果只能以 std::string 返回，cJSON 节点和 cJSON_Print 的字符串不能带出本函数
+    JsonArena arena(json_content.length());
     
     // 检查JSON是否被截断，尝试修复
     std::string fixed_json = json_content;
@@ -522,6 +533,9 @@ ReturnValue BochaSearch::DoOutfitSearch(const PropertyList& properties) {
 
 std::string BochaSearch::ParseOutfitSearchResults(const std::string& json_content) {
     ESP_LOGD(TAG, "Parsing outfit search JSON response (%zu bytes)", json_content.length());
+    // ParseSearchResults 在嵌套的 arena 中解析，返回的是 std::string 拷贝；
+    // 这里的树同样不能带出本函数
+    JsonArena arena(json_content.length());
     
     // 使用基础的解析函数，然后增强结果
     std::string basic_results = ParseSearchResults(json_content);
@@ -0,0 +1,19 @@
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#include <string_view>
+#include <cstdint>
+
+#define FNV1A_OFFSET_BASIS 2166136261u
+#define FNV1A_PRIME 16777619u
+
+// 32-bit FNV-1a. constexpr so hashes of string literals are computed at compile time.
+// Pass the previous result as hash to continue hashing over several pieces.
+constexpr uint32_t Fnv1a(std::string_view data, uint32_t hash = FNV1A_OFFSET_BASIS) {
+    for (char c : data) {
+        hash = (hash ^ (uint8_t)c) * FNV1A_PRIME;
+    }
+    return hash;
+}
+
+#endif // FNV1A_H
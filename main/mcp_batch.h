@@ -0,0 +1,62 @@
+#ifndef MCP_BATCH_H
+#define MCP_BATCH_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#include "json_writer.h"
+
+// JSON-RPC 批量请求的响应收集器。同步方法的响应在解析时直接加入，
+// 交给工作任务的 tools/call 先登记，完成后再加入；全部到齐后合并为一个数组，
+// 通过 send 一次发送
+class McpBatch {
+public:
+    explicit McpBatch(std::function<void(std::string payload)> send) : send_(std::move(send)) {}
+
+    void Add(std::string response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        responses_.push_back(std::move(response));
+    }
+
+    void Expect() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+    }
+
+    // 完成一个登记的响应，response 为空表示该请求不需要回复
+    // 解析结束时也调用一次，释放初始计数
+    void Complete(std::string response) {
+        std::string payload;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!response.empty()) {
+                responses_.push_back(std::move(response));
+            }
+            if (--pending_ > 0 || responses_.empty()) {
+                return;
+            }
+            size_t size = 2;
+            for (auto& item : responses_) {
+                size += item.size() + 1;
+            }
+            JsonWriter writer(payload);
+            writer.Reserve(size).BeginArray();
+            for (auto& item : responses_) {
+                writer.Raw(item);
+            }
+            writer.EndArray();
+            responses_.clear();
+        }
+        send_(std::move(payload));
+    }
+
+private:
+    std::function<void(std::string payload)> send_;
+    std::mutex mutex_;
+    std::vector<std::string> responses_;
+    int pending_ = 1;
+};
+
+#endif // MCP_BATCH_H
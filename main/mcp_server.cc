@@ -8,21 +8,73 @@
 #include <esp_app_desc.h>
 #include <algorithm>
 #include <cstring>
-#include <esp_pthread.h>
+#include <cstdio>
+#include <esp_timer.h>
+#include <freertos/task.h>
 
 #include "application.h"
 #include "display.h"
 #include "board.h"
 #include "bocha_search.h"
+#include "json_writer.h"
+#include "json_arena.h"
+#include "mcp_batch.h"
+#include "mcp_typed_tool.h"
 
 #define TAG "MCP"
 
 #define DEFAULT_TOOLCALL_STACK_SIZE 6144
+#define LARGE_TOOLCALL_STACK_SIZE CONFIG_MCP_TOOL_LARGE_STACK_SIZE
+#define DEFAULT_TOOLCALL_TIMEOUT_MS 60000
+#define DEVICE_STATUS_CACHE_TTL_MS 2000
+#define TOOLS_CHANGED_NOTIFY_DELAY_MS 1000
+
+static constexpr McpToolKey kDeviceStatusTool("self.get_device_status");
+#define TOOLS_LIST_MAX_PAYLOAD_SIZE 8000
+// {"jsonrpc":"2.0","id":-2147483648,"result":}
+#define TOOLS_LIST_ENVELOPE_SIZE 44
+
+// 通用工具的参数，见 mcp_typed_tool.h
+struct SetVolumeArgs {
+    int volume;
+};
+
+struct SetBrightnessArgs {
+    int brightness;
+};
+
+struct SetThemeArgs {
+    std::string theme;
+};
+
+struct TakePhotoArgs {
+    std::string question;
+};
 
 McpServer::McpServer() {
+    tool_workers_[0] = {this, "tool_call", DEFAULT_TOOLCALL_STACK_SIZE, CONFIG_MCP_TOOL_WORKERS, nullptr};
+    tool_workers_[1] = {this, "tool_call_large", LARGE_TOOLCALL_STACK_SIZE, 1, nullptr};
+
+    esp_timer_create_args_t tools_changed_timer_args = {
+        .callback = [](void* arg) {
+            auto server = (McpServer*)arg;
+            Application::GetInstance().Schedule([server]() {
+                server->NotifyToolsChanged();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp_tools_changed",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&tools_changed_timer_args, &tools_changed_timer_);
 }
 
 McpServer::~McpServer() {
+    if (tools_changed_timer_ != nullptr) {
+        esp_timer_stop(tools_changed_timer_);
+        esp_timer_delete(tools_changed_timer_);
+    }
     for (auto tool : tools_) {
         delete tool;
     }
@@ -33,7 +85,13 @@ void McpServer::AddCommonTools() {
     // To speed up the response time, we add the common tools to the beginning of
     // the tools list to utilize the prompt cache.
     // Backup the original tools list and restore it after adding the common tools.
-    auto original_tools = std::move(tools_);
+    std::vector<McpTool*> original_tools;
+    {
+        std::lock_guard<std::mutex> lock(tools_mutex_);
+        original_tools = std::move(tools_);
+        tools_.clear();
+        tool_index_.clear();
+    }
     auto& board = Board::GetInstance();
 
     AddTool("self.get_device_status",
@@ -45,88 +103,167 @@ void McpServer::AddCommonTools() {
         [&board](const PropertyList& properties) -> ReturnValue {
             return board.GetDeviceStatusJson();
         });
+    // 一轮对话中设备状态常被反复查询，短时间内复用结果；下面修改状态的工具会主动失效缓存
+    SetToolCacheTtl(kDeviceStatusTool, DEVICE_STATUS_CACHE_TTL_MS);
 
-    AddTool("self.audio_speaker.set_volume", 
+    AddTool(MakeMcpTool<SetVolumeArgs>("self.audio_speaker.set_volume", 
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
-        PropertyList({
-            Property("volume", kPropertyTypeInteger, 0, 100)
-        }), 
-        [&board](const PropertyList& properties) -> ReturnValue {
+        [this, &board](const SetVolumeArgs& args) -> ReturnValue {
             auto codec = board.GetAudioCodec();
-            codec->SetOutputVolume(properties["volume"].value<int>());
+            codec->SetOutputVolume(args.volume);
+            InvalidateToolCache(kDeviceStatusTool);
             return true;
-        });
+        },
+        McpArg("volume", &SetVolumeArgs::volume).Range(0, 100)));
     
     auto backlight = board.GetBacklight();
     if (backlight) {
-        AddTool("self.screen.set_brightness",
+        AddTool(MakeMcpTool<SetBrightnessArgs>("self.screen.set_brightness",
             "Set the brightness of the screen.",
-            PropertyList({
-                Property("brightness", kPropertyTypeInteger, 0, 100)
-            }),
-            [backlight](const PropertyList& properties) -> ReturnValue {
-                uint8_t brightness = static_cast<uint8_t>(properties["brightness"].value<int>());
-                backlight->SetBrightness(brightness, true);
+            [this, backlight](const SetBrightnessArgs& args) -> ReturnValue {
+                backlight->SetBrightness(static_cast<uint8_t>(args.brightness), true);
+                InvalidateToolCache(kDeviceStatusTool);
                 return true;
-            });
+            },
+            McpArg("brightness", &SetBrightnessArgs::brightness).Range(0, 100)));
     }
 
     auto display = board.GetDisplay();
     if (display && !display->GetTheme().empty()) {
-        AddTool("self.screen.set_theme",
+        AddTool(MakeMcpTool<SetThemeArgs>("self.screen.set_theme",
             "Set the theme of the screen. The theme can be `light` or `dark`.",
-            PropertyList({
-                Property("theme", kPropertyTypeString)
-            }),
-            [display](const PropertyList& properties) -> ReturnValue {
-                display->SetTheme(properties["theme"].value<std::string>().c_str());
+            [this, display](const SetThemeArgs& args) -> ReturnValue {
+                display->SetTheme(args.theme.c_str());
+                InvalidateToolCache(kDeviceStatusTool);
                 return true;
-            });
+            },
+            McpArg("theme", &SetThemeArgs::theme)));
     }
 
     auto camera = board.GetCamera();
     if (camera) {
-        AddTool("self.camera.take_photo",
+        AddTool(MakeMcpTool<TakePhotoArgs>("self.camera.take_photo",
             "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
             "Args:\n"
             "  `question`: The question that you want to ask about the photo.\n"
             "Return:\n"
             "  A JSON object that provides the photo information.",
-            PropertyList({
-                Property("question", kPropertyTypeString)
-            }),
-            [camera](const PropertyList& properties) -> ReturnValue {
+            [camera](const TakePhotoArgs& args, McpToolContext& context) -> ReturnValue {
+                context.ReportProgress(0, 2, "Capturing photo");
                 if (!camera->Capture()) {
                     return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                 }
-                auto question = properties["question"].value<std::string>();
-                return camera->Explain(question);
-            });
+                if (context.ShouldStop()) {
+                    throw std::runtime_error("Tool call cancelled or timed out");
+                }
+                context.ReportProgress(1, 2, "Explaining photo");
+                return camera->Explain(args.question);
+            },
+            McpArg("question", &TakePhotoArgs::question)), kMcpToolStackLarge);
     }
 
     // Add Bocha AI search tool
     BochaSearch::RegisterTools();
 
     // Restore the original tools list to the end of the tools list
+    std::lock_guard<std::mutex> lock(tools_mutex_);
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    RebuildToolIndex();
+    tools_pages_valid_ = false;
+}
+
+void McpServer::RebuildToolIndex() {
+    tool_index_.clear();
+    tool_index_.reserve(tools_.size());
+    for (size_t i = 0; i < tools_.size(); ++i) {
+        tool_index_.emplace(McpToolNameHash(tools_[i]->name()), i);
+    }
+}
+
+// 工具注册后不会被删除，返回的指针在解锁后仍然有效
+McpTool* McpServer::FindTool(const McpToolKey& key) const {
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+    return FindToolLocked(key);
+}
+
+McpTool* McpServer::FindToolLocked(const McpToolKey& key) const {
+    auto range = tool_index_.equal_range(key.hash());
+    for (auto it = range.first; it != range.second; ++it) {
+        auto tool = tools_[it->second];
+        if (tool->name() == key.name()) {
+            return tool;
+        }
+    }
+    return nullptr;
+}
+
+void McpServer::AddTool(McpTool* tool, McpToolStackClass stack_class) {
+    if (stack_class != kMcpToolStackDefault) {
+        tool->SetStackClass(stack_class);
+    }
+    {
+        std::lock_guard<std::mutex> lock(tools_mutex_);
+        // Prevent adding duplicate tools
+        if (FindToolLocked(McpToolKey(tool->name())) != nullptr) {
+            ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
+            return;
+        }
+
+        ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
+        tool_index_.emplace(McpToolNameHash(tool->name()), tools_.size());
+        tools_.push_back(tool);
+        tools_pages_valid_ = false;
+    }
+
+    // 客户端已获取过工具列表，合并一段时间内新增的工具后再通知
+    std::lock_guard<std::mutex> lock(tools_changed_mutex_);
+    if (client_initialized_) {
+        tools_added_.push_back(tool->name());
+        esp_timer_stop(tools_changed_timer_);
+        esp_timer_start_once(tools_changed_timer_, TOOLS_CHANGED_NOTIFY_DELAY_MS * 1000);
+    }
 }
 
-void McpServer::AddTool(McpTool* tool) {
-    // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
-        ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
+void McpServer::NotifyToolsChanged() {
+    std::vector<std::string> added;
+    {
+        std::lock_guard<std::mutex> lock(tools_changed_mutex_);
+        added.swap(tools_added_);
+    }
+    if (added.empty()) {
         return;
     }
 
-    ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
-    tools_.push_back(tool);
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("method", "notifications/tools/list_changed")
+        .Key("params").BeginObject()
+            .Field("etag", GetToolsEtag())
+            .Key("added").BeginArray();
+    for (auto& name : added) {
+        writer.String(name);
+    }
+    writer.EndArray().EndObject().EndObject();
+    ESP_LOGI(TAG, "Tools list changed, %u tools added", (unsigned)added.size());
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, McpToolCallback callback,
+    McpToolStackClass stack_class) {
+    AddTool(new McpTool(name, description, properties, callback), stack_class);
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-    AddTool(new McpTool(name, description, properties, callback));
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, McpToolContextCallback callback,
+    McpToolStackClass stack_class) {
+    AddTool(new McpTool(name, description, properties, callback), stack_class);
 }
 
 void McpServer::ParseMessage(const std::string& message) {
+    // 整棵请求树在 arena 中，本函数返回即释放。工具参数在 DoToolCall 中同步绑定为
+    // PropertyList 后才交给 worker 任务，不能把 cJSON 节点传给 worker 或回调
+    JsonArena arena(message.size());
     cJSON* json = cJSON_Parse(message.c_str());
     if (json == nullptr) {
         ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
@@ -155,7 +292,38 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
     }
 }
 
+void McpServer::ParseBatch(const cJSON* json) {
+    if (cJSON_GetArraySize(json) == 0) {
+        ESP_LOGE(TAG, "Empty JSONRPC batch");
+        return;
+    }
+
+    auto batch = std::make_shared<McpBatch>([](std::string payload) {
+        Application::GetInstance().SendMcpMessage(std::move(payload));
+    });
+    current_batch_ = batch;
+    cJSON* item;
+    cJSON_ArrayForEach(item, json) {
+        if (cJSON_IsObject(item)) {
+            ParseMessage(item);
+        } else {
+            ESP_LOGE(TAG, "Invalid JSONRPC batch item");
+        }
+    }
+    current_batch_.reset();
+    batch->Complete("");
+}
+
 void McpServer::ParseMessage(const cJSON* json) {
+    if (cJSON_IsArray(json)) {
+        if (current_batch_) {
+            ESP_LOGE(TAG, "Nested JSONRPC batch");
+            return;
+        }
+        ParseBatch(json);
+        return;
+    }
+
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -165,6 +333,10 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     // Check method
     auto method = cJSON_GetObjectItem(json, "method");
+    if (method == nullptr && (cJSON_GetObjectItem(json, "result") != nullptr || cJSON_GetObjectItem(json, "error") != nullptr)) {
+        ParseResponse(json);
+        return;
+    }
     if (method == nullptr || !cJSON_IsString(method)) {
         ESP_LOGE(TAG, "Missing method");
         return;
@@ -172,6 +344,13 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolCall(request_id->valueint);
+            }
+        }
         return;
     }
     
@@ -196,10 +375,23 @@ void McpServer::ParseMessage(const cJSON* json) {
                 ParseCapabilities(capabilities);
             }
         }
+        {
+            // 客户端随后会拉取完整列表，此前新增的工具无需再单独通知
+            std::lock_guard<std::mutex> lock(tools_changed_mutex_);
+            client_initialized_ = true;
+            tools_added_.clear();
+        }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
+        std::string message;
+        JsonWriter writer(message);
+        writer.BeginObject()
+            .Field("protocolVersion", "2024-11-05")
+            .RawField("capabilities", "{\"tools\":{\"listChanged\":true}}")
+            .Key("serverInfo").BeginObject()
+                .Field("name", BOARD_NAME)
+                .Field("version", app_desc->version)
+            .EndObject()
+        .EndObject();
         ReplyResult(id_int, message);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
@@ -234,202 +426,525 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid stackSize");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE);
+        auto timeout = cJSON_GetObjectItem(params, "timeout");
+        if (timeout != nullptr && !cJSON_IsNumber(timeout)) {
+            ESP_LOGE(TAG, "tools/call: Invalid timeout");
+            ReplyError(id_int, "Invalid timeout");
+            return;
+        }
+        // 进度通知使用请求 _meta 中的 progressToken，保留其原始 JSON 形式
+        std::string progress_token;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto token = cJSON_GetObjectItem(meta, "progressToken");
+        if (cJSON_IsNumber(token) || cJSON_IsString(token)) {
+            char* token_str = cJSON_PrintUnformatted(token);
+            progress_token = token_str;
+            cJSON_free(token_str);
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments,
+            stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE,
+            progress_token, timeout ? timeout->valueint : DEFAULT_TOOLCALL_TIMEOUT_MS);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
     }
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+std::string McpServer::MakeResult(int id, std::string_view result) {
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.Reserve(result.size() + 40).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("id", id)
+        .RawField("result", result)
+    .EndObject();
+    return payload;
 }
 
-void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+std::string McpServer::MakeError(int id, std::string_view message) {
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.Reserve(message.size() + 56).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("id", id)
+        .Key("error").BeginObject()
+            .Field("message", message)
+        .EndObject()
+    .EndObject();
+    return payload;
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
+// 只在解析线程调用；处于批量请求中时响应先收集起来
+void McpServer::Reply(std::string payload) {
+    if (current_batch_) {
+        current_batch_->Add(std::move(payload));
+    } else {
+        Application::GetInstance().SendMcpMessage(std::move(payload));
+    }
+}
+
+void McpServer::ReplyResult(int id, std::string_view result) {
+    Reply(MakeResult(id, result));
+}
+
+void McpServer::ReplyError(int id, std::string_view message) {
+    Reply(MakeError(id, message));
+}
+
+void McpServer::SendProgress(const std::string& progress_token, int progress, int total, const std::string& message) {
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.Reserve(message.size() + progress_token.size() + 112).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("method", "notifications/progress")
+        .Key("params").BeginObject()
+            .RawField("progressToken", progress_token)
+            .Field("progress", progress);
+    if (total > 0) {
+        writer.Field("total", total);
+    }
+    if (!message.empty()) {
+        writer.Field("message", message);
+    }
+    writer.EndObject().EndObject();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+void McpServer::ResetSession() {
+    {
+        std::lock_guard<std::mutex> lock(tools_changed_mutex_);
+        client_initialized_ = false;
+        tools_added_.clear();
+        esp_timer_stop(tools_changed_timer_);
+    }
+    std::lock_guard<std::mutex> lock(ping_mutex_);
+    ping_sent_time_us_ = 0;
+}
+
+bool McpServer::SendPing() {
+    std::string payload;
+    {
+        std::lock_guard<std::mutex> lock(tools_changed_mutex_);
+        if (!client_initialized_) {
+            return false;
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ping_mutex_);
+        int64_t now = esp_timer_get_time();
+        if (ping_sent_time_us_ != 0 && now - ping_sent_time_us_ < MCP_PING_TIMEOUT_MS * 1000LL) {
+            return false;
         }
-        
-        json += tool_json;
-        ++it;
+        // 字符串 id，不会与客户端请求的整数 id 混淆
+        ping_id_ = "ping-" + std::to_string(++ping_count_);
+        ping_sent_time_us_ = now;
+        JsonWriter(payload).BeginObject()
+            .Field("jsonrpc", "2.0")
+            .Field("id", ping_id_)
+            .Field("method", "ping")
+        .EndObject();
     }
-    
-    if (json.back() == ',') {
-        json.pop_back();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+    return true;
+}
+
+void McpServer::OnPingReply(std::function<void(int rtt_ms)> callback) {
+    on_ping_reply_ = callback;
+}
+
+// 设备只发送 ping 请求。不支持 ping 的客户端返回的错误同样是一次往返，也计入
+void McpServer::ParseResponse(const cJSON* json) {
+    auto id = cJSON_GetObjectItem(json, "id");
+    if (!cJSON_IsString(id)) {
+        return;
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+
+    int64_t sent_time_us;
+    {
+        std::lock_guard<std::mutex> lock(ping_mutex_);
+        if (ping_sent_time_us_ == 0 || ping_id_ != id->valuestring) {
+            return;
+        }
+        sent_time_us = ping_sent_time_us_;
+        ping_sent_time_us_ = 0;
+    }
+    int rtt_ms = (esp_timer_get_time() - sent_time_us) / 1000;
+    if (on_ping_reply_ != nullptr) {
+        on_ping_reply_(rtt_ms);
+    }
+}
+
+void McpServer::CancelToolCall(int id) {
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    auto it = active_calls_.find(id);
+    if (it == active_calls_.end()) {
+        ESP_LOGW(TAG, "notifications/cancelled: No active call %d", id);
         return;
     }
+    ESP_LOGI(TAG, "notifications/cancelled: Cancel call %d", id);
+    it->second->Cancel();
+}
 
-    if (next_cursor.empty()) {
-        json += "]}";
+void McpServer::FinishToolCall(const std::shared_ptr<McpToolContext>& context) {
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    auto it = active_calls_.find(context->id());
+    if (it != active_calls_.end() && it->second == context) {
+        active_calls_.erase(it);
+    }
+}
+
+void McpToolContext::ReportProgress(int progress, int total, const std::string& message) {
+    if (progress_token_.empty() || IsCancelled()) {
+        return;
+    }
+    McpServer::GetInstance().SendProgress(progress_token_, progress, total, message);
+}
+
+// 调用时需持有 tools_mutex_
+void McpServer::BuildToolsPages() {
+    tools_pages_.clear();
+    size_t start = 0;
+    while (start < tools_.size()) {
+        tools_pages_.push_back(start);
+        size_t end = GetMcpToolsPageEnd(tools_, start, TOOLS_LIST_MAX_PAYLOAD_SIZE);
+        if (end == start) {
+            // 单个工具超出大小限制，停止分页，请求到该页时返回错误
+            break;
+        }
+        start = end;
+    }
+
+    // FNV-1a over all schemas in order, so the etag survives reboots while the tools stay the same
+    uint32_t hash = FNV1A_OFFSET_BASIS;
+    for (auto tool : tools_) {
+        hash = Fnv1a(tool->to_json(), hash);
+        hash = Fnv1a(",", hash);
+    }
+    tools_etag_ = hash;
+    tools_pages_valid_ = true;
+}
+
+// 调用时需持有 tools_mutex_
+std::string McpServer::GetToolsEtagLocked() {
+    if (!tools_pages_valid_) {
+        BuildToolsPages();
+    }
+    char etag[MCP_TOOLS_ETAG_LENGTH + 1];
+    snprintf(etag, sizeof(etag), "%08lx", (unsigned long)tools_etag_);
+    return etag;
+}
+
+std::string McpServer::GetToolsEtag() {
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+    return GetToolsEtagLocked();
+}
+
+void McpServer::GetToolsList(int id, const std::string& cursor) {
+    // 整个响应在锁内生成，期间新增的工具不会让分页与 etag 不一致
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+
+    // 游标格式为 "<下一页首个工具名>@<etag>"，只有 "@<etag>" 时表示条件拉取第一页；
+    // 不带 etag 的旧格式游标仍按工具名处理
+    auto etag = GetToolsEtagLocked();
+    std::string_view cursor_name = cursor;
+    auto at = cursor.rfind('@');
+    if (at != std::string::npos) {
+        std::string_view cursor_etag = std::string_view(cursor).substr(at + 1);
+        cursor_name = cursor_name.substr(0, at);
+        if (cursor_name.empty() && cursor_etag == etag) {
+            std::string payload;
+            JsonWriter writer(payload);
+            writer.BeginObject()
+                .Field("jsonrpc", "2.0")
+                .Field("id", id)
+                .Key("result").BeginObject()
+                    .Key("tools").BeginArray().EndArray()
+                    .Field("etag", etag)
+                    .Field("notModified", true)
+                .EndObject()
+            .EndObject();
+            Reply(std::move(payload));
+            return;
+        }
+        if (!cursor_name.empty() && cursor_etag != etag) {
+            ESP_LOGW(TAG, "tools/list: Tools changed during pagination");
+            ReplyError(id, "Tools list changed, please fetch it again from the beginning");
+            return;
+        }
+    }
+
+    // 通过哈希索引直接定位游标中工具的下标
+    size_t start = 0;
+    if (!cursor_name.empty()) {
+        start = tools_.size();
+        auto range = tool_index_.equal_range(McpToolNameHash(cursor_name));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (tools_[it->second]->name() == cursor_name) {
+                start = it->second;
+                break;
+            }
+        }
+    }
+
+    // 游标通常指向预先计算好的页起点，否则按旧逻辑从该工具开始重新计算
+    size_t end;
+    auto page = std::lower_bound(tools_pages_.begin(), tools_pages_.end(), start);
+    if (page != tools_pages_.end() && *page == start && page + 1 != tools_pages_.end()) {
+        end = *(page + 1);
     } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+        end = GetMcpToolsPageEnd(tools_, start, TOOLS_LIST_MAX_PAYLOAD_SIZE);
     }
-    
-    ReplyResult(id, json);
+
+    if (end == start && start < tools_.size()) {
+        // 如果没有添加任何tool，返回错误
+        auto& name = tools_[start]->name();
+        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", name.c_str());
+        ReplyError(id, "Failed to add tool " + name + " because of payload size limit");
+        return;
+    }
+
+    // 直接写出完整的 JSON-RPC 响应，缓存的工具 schema 原样拼接，避免中间拷贝。
+    // 预留的大小是这一页的确切长度加上 {"jsonrpc":"2.0","id":<id>,"result":} 外壳
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.Reserve(GetMcpToolsPageLength(tools_, start, end) + TOOLS_LIST_ENVELOPE_SIZE).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("id", id)
+        .Key("result");
+    WriteMcpToolsPage(writer, tools_, start, end, etag);
+    writer.EndObject();
+
+    Reply(std::move(payload));
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size,
+    const std::string& progress_token, int timeout_ms) {
+    auto tool = FindTool(McpToolKey(tool_name));
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    std::unique_ptr<McpToolArguments> arguments;
     try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
-
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
-            }
-        }
+        arguments = tool->BindArguments(tool_arguments, true);
     } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "tools/call: %s", e.what());
+        ESP_LOGE(TAG, "tools/call: %s: %s", tool_name.c_str(), e.what());
         ReplyError(id, e.what());
         return;
     }
 
-    // Start a task to receive data with stack size
-    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
-    cfg.thread_name = "tool_call";
-    cfg.stack_size = stack_size;
-    cfg.prio = 1;
-    esp_pthread_set_cfg(&cfg);
+    if (!tool_workers_started_) {
+        StartToolWorkers();
+    }
 
-    // Use a thread to call the tool to avoid blocking the main thread
-    tool_call_thread_ = std::thread([this, id, tool_iter, arguments = std::move(arguments)]() {
-        try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
-        } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+    // 按工具注册的栈分组和请求的栈大小选择工作任务组
+    auto worker_class = &tool_workers_[0];
+    if (tool->stack_class() == kMcpToolStackLarge || stack_size > DEFAULT_TOOLCALL_STACK_SIZE) {
+        worker_class = &tool_workers_[1];
+        if (stack_size > LARGE_TOOLCALL_STACK_SIZE) {
+            ESP_LOGW(TAG, "tools/call: stackSize %d exceeds %d, running on the large worker",
+                stack_size, LARGE_TOOLCALL_STACK_SIZE);
         }
-    });
-    tool_call_thread_.detach();
+    } else if (worker_class->queue == nullptr) {
+        // 默认组没能创建，栈更大的组同样可以执行
+        worker_class = &tool_workers_[1];
+    }
+    if (worker_class->queue == nullptr) {
+        ESP_LOGE(TAG, "tools/call: no %s worker to run %s", worker_class->name, tool->name().c_str());
+        ReplyError(id, "No worker available to run the tool");
+        return;
+    }
+
+    // 截止时间从入队开始计算，排队时间也计入
+    int64_t now = esp_timer_get_time();
+    auto context = std::make_shared<McpToolContext>(id, progress_token, timeout_ms > 0 ? now + timeout_ms * 1000LL : 0);
+    {
+        std::lock_guard<std::mutex> lock(active_calls_mutex_);
+        active_calls_[id] = context;
+    }
+
+    // 批量请求中的调用在完成前占用一个计数，保证整批响应一次发出
+    auto batch = current_batch_;
+    if (batch) {
+        batch->Expect();
+    }
+    auto request = new ToolCallRequest{tool, std::move(arguments), context, batch, now};
+    if (xQueueSend(worker_class->queue, &request, 0) != pdTRUE) {
+        delete request;
+        FinishToolCall(context);
+        {
+            std::lock_guard<std::mutex> lock(tool_call_stats_mutex_);
+            tool_call_stats_.rejected++;
+        }
+        ESP_LOGW(TAG, "tools/call: %s queue is full, rejecting %s", worker_class->name, tool->name().c_str());
+        if (batch) {
+            batch->Complete(MakeError(id, "Server busy, too many tool calls in progress"));
+            return;
+        }
+        ReplyError(id, "Server busy, too many tool calls in progress");
+    }
 }
 
-bool McpServer::CallToolLocal(const std::string& tool_name) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(),
-        [&tool_name](const McpTool* tool) { return tool->name() == tool_name; });
-    if (tool_iter == tools_.end()) {
-        ESP_LOGE(TAG, "CallToolLocal: Unknown tool: %s", tool_name.c_str());
-        return false;
+// 工作任务在首次调用时创建，之后常驻，避免每次调用都创建/销毁线程
+// 内存不足时某组可能一个任务都创建不了，该组的 queue 保持为空，DoToolCall 据此改用其他组或拒绝调用。
+// 两组都失败时下次调用再重试
+void McpServer::StartToolWorkers() {
+    bool any_started = false;
+    for (auto& worker_class : tool_workers_) {
+        if (worker_class.queue != nullptr) {
+            any_started = true;
+            continue;
+        }
+        auto queue = xQueueCreate(CONFIG_MCP_TOOL_QUEUE_SIZE, sizeof(ToolCallRequest*));
+        if (queue == nullptr) {
+            ESP_LOGE(TAG, "Failed to create the %s queue", worker_class.name);
+            continue;
+        }
+        worker_class.queue = queue;
+
+        int started = 0;
+        for (int i = 0; i < worker_class.workers; i++) {
+            BaseType_t ret = xTaskCreate([](void* arg) {
+                auto worker_class = (ToolWorkerClass*)arg;
+                worker_class->server->ToolWorkerTask(worker_class);
+                vTaskDelete(NULL);
+            }, worker_class.name, worker_class.stack_size, &worker_class, 1, nullptr);
+            if (ret != pdPASS) {
+                ESP_LOGE(TAG, "Failed to create %s worker %d of %d (stack %u)", worker_class.name, i + 1,
+                    worker_class.workers, (unsigned)worker_class.stack_size);
+                break;
+            }
+            started++;
+        }
+        if (started == 0) {
+            vQueueDelete(queue);
+            worker_class.queue = nullptr;
+            continue;
+        }
+        if (started < worker_class.workers) {
+            ESP_LOGW(TAG, "Running %s with %d of %d workers", worker_class.name, started, worker_class.workers);
+            worker_class.workers = started;
+        }
+        any_started = true;
     }
+    tool_workers_started_ = any_started;
+}
 
-    try {
-        PropertyList arguments = (*tool_iter)->properties();
-        // No arguments provided; rely on defaults if any
-        auto result = (*tool_iter)->Call(arguments);
-        (void)result; // result is a JSON string, discard for local calls
-        return true;
-    } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "CallToolLocal: %s", e.what());
+void McpServer::ToolWorkerTask(ToolWorkerClass* worker_class) {
+    while (true) {
+        ToolCallRequest* request = nullptr;
+        if (xQueueReceive(worker_class->queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        auto& context = *request->context;
+        int id = context.id();
+        int64_t start_time = esp_timer_get_time();
+        std::string response;
+        if (context.IsCancelled()) {
+            // 排队期间已被取消，按协议不再回复
+            ESP_LOGI(TAG, "tools/call: %s cancelled before start", request->tool->name().c_str());
+        } else if (context.IsExpired()) {
+            response = MakeError(id, "Tool call timed out before start: " + request->tool->name());
+        } else {
+            try {
+                response = MakeResult(id, request->tool->Call(*request->arguments, context));
+            } catch (const std::exception& e) {
+                ESP_LOGE(TAG, "tools/call: %s", e.what());
+                response = MakeError(id, e.what());
+            }
+            if (context.IsCancelled()) {
+                response.clear();
+            }
+        }
+        FinishToolCall(request->context);
+        if (request->batch) {
+            request->batch->Complete(std::move(response));
+        } else if (!response.empty()) {
+            Application::GetInstance().SendMcpMessage(std::move(response));
+        }
+        int64_t end_time = esp_timer_get_time();
+
+        uint32_t wait_ms = (start_time - request->enqueue_time_us) / 1000;
+        uint32_t run_ms = (end_time - start_time) / 1000;
+        ESP_LOGI(TAG, "tools/call: %s waited %lu ms, ran %lu ms", request->tool->name().c_str(),
+            (unsigned long)wait_ms, (unsigned long)run_ms);
+        {
+            std::lock_guard<std::mutex> lock(tool_call_stats_mutex_);
+            tool_call_stats_.completed++;
+            tool_call_stats_.max_wait_ms = std::max(tool_call_stats_.max_wait_ms, wait_ms);
+            tool_call_stats_.max_run_ms = std::max(tool_call_stats_.max_run_ms, run_ms);
+        }
+        delete request;
+    }
+}
+
+McpToolCallStats McpServer::GetToolCallStats() {
+    McpToolCallStats stats;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_stats_mutex_);
+        stats = tool_call_stats_;
+    }
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+    for (auto tool : tools_) {
+        if (tool->cache_enabled()) {
+            stats.cache_hits += tool->cache_hits();
+            stats.cache_misses += tool->cache_misses();
+        }
+    }
+    return stats;
+}
+
+bool McpServer::SetToolCacheTtl(const McpToolKey& tool, int ttl_ms) {
+    auto mcp_tool = FindTool(tool);
+    if (mcp_tool == nullptr) {
+        ESP_LOGW(TAG, "SetToolCacheTtl: Unknown tool: %.*s", (int)tool.name().size(), tool.name().data());
         return false;
     }
+    mcp_tool->SetCacheTtl(ttl_ms);
+    return true;
 }
 
-bool McpServer::CallToolLocal(const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(),
-        [&tool_name](const McpTool* tool) { return tool->name() == tool_name; });
-    if (tool_iter == tools_.end()) {
-        ESP_LOGE(TAG, "CallToolLocal(args): Unknown tool: %s", tool_name.c_str());
+void McpServer::InvalidateToolCache(const McpToolKey& tool) {
+    auto mcp_tool = FindTool(tool);
+    if (mcp_tool != nullptr) {
+        mcp_tool->InvalidateCache();
+    }
+}
+
+bool McpServer::CallToolLocal(const McpToolKey& tool) {
+    return CallToolLocal(tool, nullptr);
+}
+
+bool McpServer::CallToolLocal(const McpToolKey& tool, const cJSON* tool_arguments) {
+    auto mcp_tool = FindTool(tool);
+    if (mcp_tool == nullptr) {
+        ESP_LOGE(TAG, "CallToolLocal: Unknown tool: %.*s", (int)tool.name().size(), tool.name().data());
         return false;
     }
 
     try {
-        PropertyList arguments = (*tool_iter)->properties();
-        // Fill properties from tool_arguments (reuse logic similar to DoToolCall)
-        if (cJSON_IsObject(tool_arguments)) {
-            for (auto& argument : arguments) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                }
-            }
-        }
-        auto result = (*tool_iter)->Call(arguments);
-        (void)result;
+        // 未提供的参数使用默认值
+        auto arguments = mcp_tool->BindArguments(tool_arguments, false);
+        auto result = mcp_tool->Call(*arguments);
+        (void)result; // result is a JSON string, discard for local calls
         return true;
     } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "CallToolLocal(args): %s", e.what());
+        ESP_LOGE(TAG, "CallToolLocal: %s", e.what());
         return false;
     }
 }
 
-bool McpServer::CallToolLocal(const std::string& tool_name, const std::string& arguments_json) {
+bool McpServer::CallToolLocal(const McpToolKey& tool, const std::string& arguments_json) {
     cJSON* json = cJSON_Parse(arguments_json.c_str());
     if (!json || !cJSON_IsObject(json)) {
         ESP_LOGE(TAG, "CallToolLocal(json): Invalid JSON arguments: %s", arguments_json.c_str());
         if (json) cJSON_Delete(json);
         return false;
     }
-    bool ok = CallToolLocal(tool_name, json);
+    bool ok = CallToolLocal(tool, json);
     cJSON_Delete(json);
     return ok;
-}
\ No newline at end of file
+}
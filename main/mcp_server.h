@@ -2,15 +2,30 @@
 #define MCP_SERVER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
-#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 
 #include <cJSON.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "fnv1a.h"
+
+#define MCP_TOOL_CACHE_MAX_ENTRIES 4
+// 未收到回复的 ping 超过该时间后可以再发下一个
+#define MCP_PING_TIMEOUT_MS 10000
 
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string>;
@@ -86,7 +101,8 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
+    // 构造属性 schema 的 cJSON 对象，调用者负责释放
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -111,7 +127,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -143,6 +163,8 @@ public:
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    auto begin() const { return properties_.begin(); }
+    auto end() const { return properties_.end(); }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
@@ -154,14 +176,16 @@ public:
         return required;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name().c_str(), property.to_cjson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -171,28 +195,100 @@ public:
     }
 };
 
+// tools/call 的执行上下文：携带截止时间和取消标记，并可向服务器上报进度。
+// 耗时较长的工具应在各步骤之间检查 ShouldStop()，尽早返回并释放资源。
+class McpToolContext {
+public:
+    McpToolContext(int id, const std::string& progress_token, int64_t deadline_us)
+        : id_(id), progress_token_(progress_token), deadline_us_(deadline_us) {}
+
+    inline int id() const { return id_; }
+    inline bool IsCancelled() const { return cancelled_.load(); }
+    inline void Cancel() { cancelled_ = true; }
+    bool IsExpired() const;
+    inline bool ShouldStop() const { return IsCancelled() || IsExpired(); }
+
+    // 发送 notifications/progress，请求未携带 progressToken 时忽略
+    void ReportProgress(int progress, int total, const std::string& message = "");
+
+private:
+    int id_;
+    std::string progress_token_;  // 原始 JSON 形式（数字或带引号的字符串）
+    int64_t deadline_us_;         // 0 表示没有截止时间
+    std::atomic<bool> cancelled_ = false;
+};
+
+using McpToolCallback = std::function<ReturnValue(const PropertyList&)>;
+using McpToolContextCallback = std::function<ReturnValue(const PropertyList&, McpToolContext&)>;
+
+// 已校验并绑定好的调用参数。解析请求时由 McpTool::BindArguments 生成，
+// 随请求交给工作任务执行，请求中的 cJSON 在此之后即可释放
+class McpToolArguments {
+public:
+    virtual ~McpToolArguments() = default;
+};
+
+// tools/call 在哪一组工作任务中执行。联网请求、拍照识别等栈占用大且耗时的工具
+// 注册为 kMcpToolStackLarge，在大栈任务中执行，不占用默认工作任务
+enum McpToolStackClass {
+    kMcpToolStackDefault,
+    kMcpToolStackLarge,
+};
+
 class McpTool {
 private:
     std::string name_;
     std::string description_;
     PropertyList properties_;
-    std::function<ReturnValue(const PropertyList&)> callback_;
-
-public:
-    McpTool(const std::string& name, 
-            const std::string& description, 
-            const PropertyList& properties, 
-            std::function<ReturnValue(const PropertyList&)> callback)
-        : name_(name), 
-        description_(description), 
-        properties_(properties), 
-        callback_(callback) {}
+    McpToolContextCallback callback_;
+    std::string schema_json_;  // 注册时序列化一次，之后只读
+    McpToolStackClass stack_class_ = kMcpToolStackDefault;
+
+    // PropertyList 形式工具的调用参数：工具参数定义的副本，填入请求中的值
+    struct PropertyListArguments : public McpToolArguments {
+        PropertyList properties;
+    };
+
+    // 结果缓存，仅对通过 SetCacheTtl 声明为幂等的工具启用
+    struct CacheEntry {
+        std::string key;
+        std::string result;
+        int64_t expire_time_us;
+    };
+    int cache_ttl_ms_ = 0;
+    std::mutex cache_mutex_;
+    std::vector<CacheEntry> cache_;
+    std::atomic<uint32_t> cache_hits_ = 0;
+    std::atomic<uint32_t> cache_misses_ = 0;
+
+    bool LookupCache(const std::string& key, std::string& result) {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        int64_t now = esp_timer_get_time();
+        for (auto& entry : cache_) {
+            if (entry.key == key && entry.expire_time_us > now) {
+                result = entry.result;
+                cache_hits_++;
+                return true;
+            }
+        }
+        cache_misses_++;
+        return false;
+    }
 
-    inline const std::string& name() const { return name_; }
-    inline const std::string& description() const { return description_; }
-    inline const PropertyList& properties() const { return properties_; }
+    void StoreCache(const std::string& key, const std::string& result) {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        int64_t now = esp_timer_get_time();
+        // 去掉过期和同键的旧条目，条目已满时淘汰最早的一条
+        cache_.erase(std::remove_if(cache_.begin(), cache_.end(), [&](const CacheEntry& entry) {
+            return entry.expire_time_us <= now || entry.key == key;
+        }), cache_.end());
+        if (cache_.size() >= MCP_TOOL_CACHE_MAX_ENTRIES) {
+            cache_.erase(cache_.begin());
+        }
+        cache_.push_back({key, result, now + cache_ttl_ms_ * 1000LL});
+    }
 
-    std::string to_json() const {
+    std::string BuildSchemaJson() const {
         std::vector<std::string> required = properties_.GetRequired();
         
         cJSON *json = cJSON_CreateObject();
@@ -201,9 +297,7 @@ public:
         
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
-        
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.to_cjson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
@@ -223,8 +317,105 @@ public:
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
+protected:
+    // 供自行描述参数的子类（如 McpTypedTool）使用，schema_json 为完整的 tools/list 条目
+    McpTool(const std::string& name, const std::string& description, std::string schema_json)
+        : name_(name), description_(description), schema_json_(std::move(schema_json)) {}
+
+    // 执行工具，arguments 为本工具 BindArguments 的结果
+    virtual ReturnValue Invoke(McpToolArguments& arguments, McpToolContext& context) {
+        return callback_(static_cast<PropertyListArguments&>(arguments).properties, context);
+    }
+
+    // 参数顺序由工具定义固定，按顺序拼接各参数值即为规范化的缓存键
+    virtual std::string MakeCacheKey(const McpToolArguments& arguments) const {
+        std::string key;
+        for (const auto& property : static_cast<const PropertyListArguments&>(arguments).properties) {
+            std::string value;
+            if (property.type() == kPropertyTypeBoolean) {
+                value = property.value<bool>() ? "1" : "0";
+            } else if (property.type() == kPropertyTypeInteger) {
+                value = std::to_string(property.value<int>());
+            } else {
+                value = property.value<std::string>();
+            }
+            AppendCacheKey(key, value);
+        }
+        return key;
+    }
+
+    static void AppendCacheKey(std::string& key, std::string_view value) {
+        key += std::to_string(value.size());
+        key += ':';
+        key += value;
+        key += ';';
+    }
+
+public:
+    McpTool(const std::string& name, 
+            const std::string& description, 
+            const PropertyList& properties, 
+            McpToolCallback callback)
+        : McpTool(name, description, properties,
+            [callback](const PropertyList& properties, McpToolContext&) { return callback(properties); }) {}
+
+    McpTool(const std::string& name, 
+            const std::string& description, 
+            const PropertyList& properties, 
+            McpToolContextCallback callback)
+        : name_(name), 
+        description_(description), 
+        properties_(properties), 
+        callback_(callback) {
+        schema_json_ = BuildSchemaJson();
+    }
+
+    virtual ~McpTool() = default;
+
+    inline const std::string& name() const { return name_; }
+    inline const std::string& description() const { return description_; }
+    inline const PropertyList& properties() const { return properties_; }
+
+    inline const std::string& to_json() const { return schema_json_; }
+
+    inline McpToolStackClass stack_class() const { return stack_class_; }
+    void SetStackClass(McpToolStackClass stack_class) { stack_class_ = stack_class; }
+
+    // 按工具定义校验 arguments（JSON 对象，可为空）并绑定参数，参数不合法时抛出异常。
+    // strict 为 false 时缺少必填参数不报错，用于固件内部的本地调用
+    virtual std::unique_ptr<McpToolArguments> BindArguments(const cJSON* arguments, bool strict) const;
+
+    // 为幂等工具开启结果缓存，相同参数在 ttl_ms 内直接返回上次的结果；0 表示关闭
+    void SetCacheTtl(int ttl_ms) {
+        cache_ttl_ms_ = ttl_ms;
+        InvalidateCache();
+    }
+
+    void InvalidateCache() {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        cache_.clear();
+    }
+
+    inline bool cache_enabled() const { return cache_ttl_ms_ > 0; }
+    inline uint32_t cache_hits() const { return cache_hits_.load(); }
+    inline uint32_t cache_misses() const { return cache_misses_.load(); }
+
+    std::string Call(McpToolArguments& arguments) {
+        McpToolContext context(-1, "", 0);
+        return Call(arguments, context);
+    }
+
+    std::string Call(McpToolArguments& arguments, McpToolContext& context) {
+        std::string cache_key;
+        if (cache_ttl_ms_ > 0) {
+            std::string cached_result;
+            cache_key = MakeCacheKey(arguments);
+            if (LookupCache(cache_key, cached_result)) {
+                return cached_result;
+            }
+        }
+
+        ReturnValue return_value = Invoke(arguments, context);
         // 返回结果
         cJSON* result = cJSON_CreateObject();
         cJSON* content = cJSON_CreateArray();
@@ -245,10 +436,65 @@ public:
         std::string result_str(json_str);
         cJSON_free(json_str);
         cJSON_Delete(result);
+
+        if (cache_ttl_ms_ > 0) {
+            StoreCache(cache_key, result_str);
+        }
         return result_str;
     }
 };
 
+// 工具名的 FNV-1a 哈希，constexpr 以便固件内的本地调用在编译期完成哈希
+constexpr uint32_t McpToolNameHash(std::string_view name) {
+    return Fnv1a(name);
+}
+
+// 工具查找键：名称及其哈希。由字符串字面量构造时可声明为 constexpr，
+// 例如 static constexpr McpToolKey kDance("self.chassis.dance");
+class McpToolKey {
+public:
+    template<size_t N>
+    constexpr McpToolKey(const char (&name)[N])
+        : name_(name, N - 1), hash_(McpToolNameHash(name_)) {}
+    // 只保存名称的视图，name 必须比键活得久，因此不接受临时字符串
+    McpToolKey(const std::string& name)
+        : name_(name), hash_(McpToolNameHash(name_)) {}
+    McpToolKey(std::string&&) = delete;
+
+    inline constexpr std::string_view name() const { return name_; }
+    inline constexpr uint32_t hash() const { return hash_; }
+
+private:
+    std::string_view name_;
+    uint32_t hash_;
+};
+
+class JsonWriter;
+
+// tools/list 的一页。result 对象为
+// {"tools":[<schema>,...],"etag":"<etag>","nextCursor":"<下一页首个工具名>@<etag>"}，
+// 最后一页不含 nextCursor。etag 固定为 8 位十六进制数
+#define MCP_TOOLS_ETAG_LENGTH 8
+// [start, end) 这一页 result 对象的确切长度
+size_t GetMcpToolsPageLength(const std::vector<McpTool*>& tools, size_t start, size_t end);
+// 从 start 开始、result 对象不超过 max_length 时能放下的工具，返回页尾下标；
+// 第一个工具就放不下时返回 start
+size_t GetMcpToolsPageEnd(const std::vector<McpTool*>& tools, size_t start, size_t max_length);
+void WriteMcpToolsPage(JsonWriter& writer, const std::vector<McpTool*>& tools, size_t start, size_t end,
+    std::string_view etag);
+
+class McpBatch;
+
+// tools/call 执行统计
+struct McpToolCallStats {
+    uint32_t completed = 0;     // 已执行完成的调用数
+    uint32_t rejected = 0;      // 队列已满被拒绝的调用数
+    uint32_t max_wait_ms = 0;   // 最长排队时间
+    uint32_t max_run_ms = 0;    // 最长执行时间
+    uint32_t cache_hits = 0;    // 结果缓存命中次数
+    uint32_t cache_misses = 0;  // 结果缓存未命中次数
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -257,37 +503,121 @@ public:
     }
 
     void AddCommonTools();
-    void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(McpTool* tool, McpToolStackClass stack_class = kMcpToolStackDefault);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, McpToolCallback callback,
+        McpToolStackClass stack_class = kMcpToolStackDefault);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, McpToolContextCallback callback,
+        McpToolStackClass stack_class = kMcpToolStackDefault);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
 
     // Execute a tool locally (without network round-trip). This uses the tool's
     // default properties (i.e., no arguments). Returns true on success.
-    bool CallToolLocal(const std::string& tool_name);
+    bool CallToolLocal(const McpToolKey& tool);
 
     // Execute a tool locally with arguments (JSON object as cJSON*).
     // Returns true on success.
-    bool CallToolLocal(const std::string& tool_name, const cJSON* tool_arguments);
+    bool CallToolLocal(const McpToolKey& tool, const cJSON* tool_arguments);
 
     // Execute a tool locally with arguments provided as JSON string
     // (must be a JSON object). Returns true on success.
-    bool CallToolLocal(const std::string& tool_name, const std::string& arguments_json);
+    bool CallToolLocal(const McpToolKey& tool, const std::string& arguments_json);
+
+    McpToolCallStats GetToolCallStats();
+
+    // 会话结束时调用，下一个会话重新 initialize 前不再发送工具变化通知
+    void ResetSession();
+
+    // 向客户端发送 MCP ping，收到回复后通过 OnPingReply 回调往返时间。
+    // 会话未初始化或上一个 ping 尚未回复时返回 false
+    bool SendPing();
+    void OnPingReply(std::function<void(int rtt_ms)> callback);
+
+    // 为幂等工具开启结果缓存（见 McpTool::SetCacheTtl），工具不存在时返回 false
+    bool SetToolCacheTtl(const McpToolKey& tool, int ttl_ms);
+    // 工具依赖的状态变化时（如音量、亮度被修改）清除其缓存结果
+    void InvalidateToolCache(const McpToolKey& tool);
 
 private:
+    friend class McpToolContext;
+
+    struct ToolCallRequest {
+        McpTool* tool;
+        std::unique_ptr<McpToolArguments> arguments;
+        std::shared_ptr<McpToolContext> context;
+        std::shared_ptr<McpBatch> batch;  // 属于批量请求时非空
+        int64_t enqueue_time_us;
+    };
+
+    // 按栈大小划分的常驻工作任务组，每组共享一个有界请求队列
+    struct ToolWorkerClass {
+        McpServer* server;
+        const char* name;
+        uint32_t stack_size;
+        int workers;
+        QueueHandle_t queue;
+    };
+
     McpServer();
     ~McpServer();
 
     void ParseCapabilities(const cJSON* capabilities);
-
-    void ReplyResult(int id, const std::string& result);
-    void ReplyError(int id, const std::string& message);
+    void ParseBatch(const cJSON* json);
+    void ParseResponse(const cJSON* json);
+    McpTool* FindTool(const McpToolKey& key) const;
+    McpTool* FindToolLocked(const McpToolKey& key) const;
+    void RebuildToolIndex();
+
+    static std::string MakeResult(int id, std::string_view result);
+    static std::string MakeError(int id, std::string_view message);
+    void Reply(std::string payload);
+    void ReplyResult(int id, std::string_view result);
+    void ReplyError(int id, std::string_view message);
+    void SendProgress(const std::string& progress_token, int progress, int total, const std::string& message);
+    void CancelToolCall(int id);
+    void FinishToolCall(const std::shared_ptr<McpToolContext>& context);
 
     void GetToolsList(int id, const std::string& cursor);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size);
-
+    void BuildToolsPages();
+    std::string GetToolsEtag();
+    std::string GetToolsEtagLocked();
+    void NotifyToolsChanged();
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size,
+        const std::string& progress_token, int timeout_ms);
+    void StartToolWorkers();
+    void ToolWorkerTask(ToolWorkerClass* worker_class);
+
+    // 保护 tools_、tool_index_ 及分页缓存。AddTool 可能在任意任务中调用，
+    // tools/list 在解析线程中处理，工具变化通知在主循环中生成
+    mutable std::mutex tools_mutex_;
     std::vector<McpTool*> tools_;
-    std::thread tool_call_thread_;
+    // 工具名哈希 -> tools_ 下标，哈希冲突时按名称区分
+    std::unordered_multimap<uint32_t, size_t> tool_index_;
+    // tools/list 分页的起始下标，AddTool 时失效，下次请求时重新计算
+    std::vector<size_t> tools_pages_;
+    bool tools_pages_valid_ = false;
+    uint32_t tools_etag_ = 0;  // 所有工具 schema 的哈希，随分页一起重新计算
+    // initialize 之后新增的工具，延迟合并后通过 notifications/tools/list_changed 通知
+    bool client_initialized_ = false;
+    std::mutex tools_changed_mutex_;
+    std::vector<std::string> tools_added_;
+    esp_timer_handle_t tools_changed_timer_ = nullptr;
+    ToolWorkerClass tool_workers_[2];
+    // 仅在调用 ParseMessage 的线程中访问（DoToolCall 是唯一的调用者）
+    bool tool_workers_started_ = false;
+    std::mutex tool_call_stats_mutex_;
+    McpToolCallStats tool_call_stats_;
+    // 尚未完成的 tools/call，用于响应 notifications/cancelled
+    std::mutex active_calls_mutex_;
+    std::map<int, std::shared_ptr<McpToolContext>> active_calls_;
+    // 设备发出的 ping，用于测量往返时间。ping_sent_time_us_ 为 0 表示没有等待回复的 ping
+    std::mutex ping_mutex_;
+    std::string ping_id_;
+    uint32_t ping_count_ = 0;
+    int64_t ping_sent_time_us_ = 0;
+    std::function<void(int rtt_ms)> on_ping_reply_;
+    // 正在解析的批量请求，仅在调用 ParseMessage 的线程中访问
+    std::shared_ptr<McpBatch> current_batch_;
 };
 
 #endif // MCP_SERVER_H
@@ -0,0 +1,90 @@
+/*
+ * McpTool 和 McpToolContext 中不依赖 McpServer 的部分
+ */
+
+#include "mcp_server.h"
+#include "json_writer.h"
+
+#include <cstring>
+#include <esp_timer.h>
+
+bool McpToolContext::IsExpired() const {
+    return deadline_us_ > 0 && esp_timer_get_time() > deadline_us_;
+}
+
+std::unique_ptr<McpToolArguments> McpTool::BindArguments(const cJSON* arguments, bool strict) const {
+    auto bound = std::make_unique<PropertyListArguments>();
+    bound->properties = properties_;
+    for (auto& argument : bound->properties) {
+        bool found = false;
+        if (cJSON_IsObject(arguments)) {
+            auto value = cJSON_GetObjectItem(arguments, argument.name().c_str());
+            if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+                argument.set_value<bool>(value->valueint == 1);
+                found = true;
+            } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+                argument.set_value<int>(value->valueint);
+                found = true;
+            } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
+                argument.set_value<std::string>(value->valuestring);
+                found = true;
+            }
+        }
+
+        if (strict && !argument.has_default_value() && !found) {
+            throw std::invalid_argument("Missing valid argument: " + argument.name());
+        }
+    }
+    return bound;
+}
+
+// 工具数组之后的部分：],"etag":"<etag>","nextCursor":"<name>@<etag>"}
+static size_t GetToolsPageTrailerLength(const std::vector<McpTool*>& tools, size_t end) {
+    size_t length = strlen("],\"etag\":\"\"}") + MCP_TOOLS_ETAG_LENGTH;
+    if (end < tools.size()) {
+        std::string name;
+        JsonWriter::AppendEscaped(name, tools[end]->name());
+        length += strlen(",\"nextCursor\":") + name.size() + strlen("@") + MCP_TOOLS_ETAG_LENGTH;
+    }
+    return length;
+}
+
+size_t GetMcpToolsPageLength(const std::vector<McpTool*>& tools, size_t start, size_t end) {
+    size_t length = strlen("{\"tools\":[");
+    for (size_t i = start; i < end; ++i) {
+        length += tools[i]->to_json().length() + (i > start ? 1 : 0);
+    }
+    return length + GetToolsPageTrailerLength(tools, end);
+}
+
+size_t GetMcpToolsPageEnd(const std::vector<McpTool*>& tools, size_t start, size_t max_length) {
+    size_t length = strlen("{\"tools\":[");
+    size_t end = start;
+    while (end < tools.size()) {
+        // 放入这个工具后，nextCursor 改为指向它后面的工具
+        size_t tool_length = tools[end]->to_json().length() + (end > start ? 1 : 0);
+        if (length + tool_length + GetToolsPageTrailerLength(tools, end + 1) > max_length) {
+            break;
+        }
+        length += tool_length;
+        ++end;
+    }
+    return end;
+}
+
+void WriteMcpToolsPage(JsonWriter& writer, const std::vector<McpTool*>& tools, size_t start, size_t end,
+    std::string_view etag) {
+    writer.BeginObject().Key("tools").BeginArray();
+    for (size_t i = start; i < end; ++i) {
+        writer.Raw(tools[i]->to_json());
+    }
+    writer.EndArray();
+    writer.Field("etag", etag);
+    if (end < tools.size()) {
+        std::string cursor;
+        cursor.reserve(tools[end]->name().size() + 1 + etag.size());
+        cursor.append(tools[end]->name()).append("@").append(etag);
+        writer.Field("nextCursor", cursor);
+    }
+    writer.EndObject();
+}
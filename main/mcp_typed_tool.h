@@ -0,0 +1,250 @@
+#ifndef MCP_TYPED_TOOL_H
+#define MCP_TYPED_TOOL_H
+
+#include <string>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+#include <cJSON.h>
+
+#include "mcp_server.h"
+#include "json_writer.h"
+
+/*
+ * 参数类型在编译期确定的 MCP 工具。
+ *
+ * 参数的类型、范围和默认值只声明一次，同一份声明用于三件事：
+ *  - 注册时生成 tools/list 中的 inputSchema，只序列化一次；
+ *  - 解析 tools/call 时直接从 cJSON 校验，并写入参数结构体的成员，不复制 PropertyList；
+ *  - 回调以 const Args& 取得参数，不再按名称查找，也不需要 value<T>()。
+ *
+ *   struct SetVolumeArgs {
+ *       int volume;
+ *   };
+ *   mcp_server.AddTool(MakeMcpTool<SetVolumeArgs>("self.audio_speaker.set_volume",
+ *       "Set the volume of the audio speaker.",
+ *       [](const SetVolumeArgs& args) -> ReturnValue {
+ *           ...
+ *           return true;
+ *       },
+ *       McpArg("volume", &SetVolumeArgs::volume).Range(0, 100)));
+ *
+ * 参数类型仅支持 bool、int 和 std::string，与 PropertyList 一致。
+ * 类型不符、不是整数或超出范围时，调用以错误结束。
+ */
+
+template<typename Args, typename T>
+class McpArgField {
+    static_assert(std::is_same_v<T, bool> || std::is_same_v<T, int> || std::is_same_v<T, std::string>,
+        "MCP tool arguments must be bool, int or std::string");
+
+public:
+    McpArgField(const char* name, T Args::*member) : name_(name), member_(member) {}
+
+    // 整数取值范围（闭区间）
+    McpArgField Range(int min_value, int max_value) const {
+        static_assert(std::is_same_v<T, int>, "Range limits only apply to integer arguments");
+        McpArgField field = *this;
+        field.has_range_ = true;
+        field.min_value_ = min_value;
+        field.max_value_ = max_value;
+        field.CheckDefault();
+        return field;
+    }
+
+    // 有默认值的参数为可选参数
+    McpArgField Default(T default_value) const {
+        McpArgField field = *this;
+        field.has_default_ = true;
+        field.default_value_ = std::move(default_value);
+        field.CheckDefault();
+        return field;
+    }
+
+    inline const char* name() const { return name_; }
+    inline bool required() const { return !has_default_; }
+
+    void WriteSchema(JsonWriter& writer) const {
+        writer.Key(name_).BeginObject();
+        if constexpr (std::is_same_v<T, bool>) {
+            writer.Field("type", "boolean");
+            if (has_default_) {
+                writer.Field("default", default_value_);
+            }
+        } else if constexpr (std::is_same_v<T, int>) {
+            writer.Field("type", "integer");
+            if (has_default_) {
+                writer.Field("default", default_value_);
+            }
+            if (has_range_) {
+                writer.Field("minimum", min_value_).Field("maximum", max_value_);
+            }
+        } else {
+            writer.Field("type", "string");
+            if (has_default_) {
+                writer.Field("default", std::string_view(default_value_));
+            }
+        }
+        writer.EndObject();
+    }
+
+    // 从请求参数中取值写入 args，arguments 不是对象时视为没有参数
+    void Bind(const cJSON* arguments, Args& args, bool strict) const {
+        const cJSON* value = cJSON_IsObject(arguments) ? cJSON_GetObjectItem(arguments, name_) : nullptr;
+        if (value == nullptr || cJSON_IsNull(value)) {
+            if (has_default_) {
+                args.*member_ = default_value_;
+            } else if (strict) {
+                throw std::invalid_argument(std::string("Missing valid argument: ") + name_);
+            }
+            return;
+        }
+
+        if constexpr (std::is_same_v<T, bool>) {
+            if (!cJSON_IsBool(value)) {
+                throw std::invalid_argument(std::string("Invalid argument: ") + name_ + " must be a boolean");
+            }
+            args.*member_ = cJSON_IsTrue(value);
+        } else if constexpr (std::is_same_v<T, int>) {
+            // valueint 在溢出时会被截断，与 valuedouble 比较即可同时排除小数和超出 int 的值
+            if (!cJSON_IsNumber(value) || value->valuedouble != (double)value->valueint) {
+                throw std::invalid_argument(std::string("Invalid argument: ") + name_ + " must be an integer");
+            }
+            if (has_range_ && (value->valueint < min_value_ || value->valueint > max_value_)) {
+                throw std::invalid_argument(std::string("Invalid argument: ") + name_ + " must be between " +
+                    std::to_string(min_value_) + " and " + std::to_string(max_value_));
+            }
+            args.*member_ = value->valueint;
+        } else {
+            if (!cJSON_IsString(value)) {
+                throw std::invalid_argument(std::string("Invalid argument: ") + name_ + " must be a string");
+            }
+            // 请求的 cJSON 在入队后即被释放，字符串只在这里复制一次
+            args.*member_ = value->valuestring;
+        }
+    }
+
+    void AppendCacheKey(const Args& args, std::string& key) const {
+        if constexpr (std::is_same_v<T, bool>) {
+            key += args.*member_ ? "1:1;" : "1:0;";
+        } else if constexpr (std::is_same_v<T, int>) {
+            auto value = std::to_string(args.*member_);
+            key += std::to_string(value.size()) + ":" + value + ";";
+        } else {
+            const std::string& value = args.*member_;
+            key += std::to_string(value.size()) + ":" + value + ";";
+        }
+    }
+
+private:
+    void CheckDefault() const {
+        if constexpr (std::is_same_v<T, int>) {
+            if (has_default_ && has_range_ && (default_value_ < min_value_ || default_value_ > max_value_)) {
+                throw std::invalid_argument("Default value must be within the specified range");
+            }
+        }
+    }
+
+    const char* name_;
+    T Args::*member_;
+    bool has_default_ = false;
+    T default_value_{};
+    bool has_range_ = false;
+    int min_value_ = 0;
+    int max_value_ = 0;
+};
+
+// 由成员指针推导参数类型，例如 McpArg("volume", &SetVolumeArgs::volume)
+template<typename Args, typename T>
+McpArgField<Args, T> McpArg(const char* name, T Args::*member) {
+    return McpArgField<Args, T>(name, member);
+}
+
+template<typename Args, typename... Types>
+class McpTypedTool : public McpTool {
+    static_assert(std::is_default_constructible_v<Args>, "MCP tool argument struct must be default constructible");
+
+public:
+    using Callback = std::function<ReturnValue(const Args&, McpToolContext&)>;
+
+    McpTypedTool(const std::string& name, const std::string& description, Callback callback,
+            McpArgField<Args, Types>... fields)
+        : McpTool(name, description, BuildSchemaJson(name, description, fields...)),
+        fields_(std::move(fields)...),
+        callback_(std::move(callback)) {}
+
+    std::unique_ptr<McpToolArguments> BindArguments(const cJSON* arguments, bool strict) const override {
+        auto bound = std::make_unique<Arguments>();
+        std::apply([&](const auto&... field) {
+            (field.Bind(arguments, bound->args, strict), ...);
+        }, fields_);
+        return bound;
+    }
+
+protected:
+    ReturnValue Invoke(McpToolArguments& arguments, McpToolContext& context) override {
+        return callback_(static_cast<Arguments&>(arguments).args, context);
+    }
+
+    std::string MakeCacheKey(const McpToolArguments& arguments) const override {
+        const Args& args = static_cast<const Arguments&>(arguments).args;
+        std::string key;
+        std::apply([&](const auto&... field) {
+            (field.AppendCacheKey(args, key), ...);
+        }, fields_);
+        return key;
+    }
+
+private:
+    struct Arguments : public McpToolArguments {
+        Args args{};
+    };
+
+    // 与 PropertyList 形式的工具生成相同结构的 tools/list 条目
+    static std::string BuildSchemaJson(const std::string& name, const std::string& description,
+            const McpArgField<Args, Types>&... fields) {
+        std::string schema;
+        JsonWriter writer(schema);
+        writer.Reserve(name.size() + description.size() + 64 + sizeof...(Types) * 64);
+        writer.BeginObject()
+            .Field("name", std::string_view(name))
+            .Field("description", std::string_view(description))
+            .Key("inputSchema").BeginObject()
+            .Field("type", "object")
+            .Key("properties").BeginObject();
+        (fields.WriteSchema(writer), ...);
+        writer.EndObject();
+        if ((fields.required() || ...)) {
+            writer.Key("required").BeginArray();
+            ((fields.required() ? (void)writer.String(fields.name()) : (void)0), ...);
+            writer.EndArray();
+        }
+        writer.EndObject().EndObject();
+        return schema;
+    }
+
+    std::tuple<McpArgField<Args, Types>...> fields_;
+    Callback callback_;
+};
+
+// 创建 McpTypedTool，回调可以是 ReturnValue(const Args&) 或 ReturnValue(const Args&, McpToolContext&)
+template<typename Args, typename Callback, typename... Types>
+McpTool* MakeMcpTool(const std::string& name, const std::string& description, Callback callback,
+        McpArgField<Args, Types>... fields) {
+    if constexpr (std::is_invocable_v<Callback, const Args&, McpToolContext&>) {
+        return new McpTypedTool<Args, Types...>(name, description, std::move(callback), std::move(fields)...);
+    } else {
+        static_assert(std::is_invocable_v<Callback, const Args&>,
+            "MCP tool callback must take (const Args&) or (const Args&, McpToolContext&)");
+        return new McpTypedTool<Args, Types...>(name, description,
+            [callback = std::move(callback)](const Args& args, McpToolContext&) -> ReturnValue {
+                return callback(args);
+            }, std::move(fields)...);
+    }
+}
+
+#endif // MCP_TYPED_TOOL_H
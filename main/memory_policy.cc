@@ -0,0 +1,51 @@
+#include "memory_policy.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "MemoryPolicy"
+
+static const char* const LEVEL_STRINGS[] = {
+    "normal",
+    "low",
+    "critical",
+};
+
+MemoryPressureLevel MemoryPolicy::GetLevel(size_t free_bytes, size_t low_bytes, size_t critical_bytes) const {
+    // Leaving a level needs some margin above its watermark
+    auto current = level_.load();
+    if (current >= kMemoryPressureCritical) {
+        critical_bytes += critical_bytes * MEMORY_RESTORE_MARGIN_PERCENT / 100;
+    }
+    if (current >= kMemoryPressureLow) {
+        low_bytes += low_bytes * MEMORY_RESTORE_MARGIN_PERCENT / 100;
+    }
+
+    if (free_bytes < critical_bytes) {
+        return kMemoryPressureCritical;
+    } else if (free_bytes < low_bytes) {
+        return kMemoryPressureLow;
+    }
+    return kMemoryPressureNormal;
+}
+
+bool MemoryPolicy::Update() {
+    size_t free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    auto level = GetLevel(free_sram, MEMORY_LOW_SRAM_BYTES, MEMORY_CRITICAL_SRAM_BYTES);
+
+#if CONFIG_SPIRAM
+    size_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    auto psram_level = GetLevel(free_psram, MEMORY_LOW_PSRAM_BYTES, MEMORY_CRITICAL_PSRAM_BYTES);
+    if (psram_level > level) {
+        level = psram_level;
+    }
+#endif
+
+    if (level == level_) {
+        return false;
+    }
+
+    ESP_LOGW(TAG, "Memory pressure: %s -> %s (free sram: %u)", LEVEL_STRINGS[level_], LEVEL_STRINGS[level], free_sram);
+    level_ = level;
+    return true;
+}
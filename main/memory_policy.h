@@ -0,0 +1,57 @@
+#ifndef _MEMORY_POLICY_H_
+#define _MEMORY_POLICY_H_
+
+#include <cstddef>
+#include <atomic>
+
+// Free internal SRAM / PSRAM watermarks for entering each pressure level
+#define MEMORY_LOW_SRAM_BYTES (40 * 1024)
+#define MEMORY_CRITICAL_SRAM_BYTES (20 * 1024)
+#define MEMORY_LOW_PSRAM_BYTES (512 * 1024)
+#define MEMORY_CRITICAL_PSRAM_BYTES (128 * 1024)
+// Extra free memory required before leaving a level, to avoid flapping
+#define MEMORY_RESTORE_MARGIN_PERCENT 25
+// Wake word PCM kept for the clip sent with wake word detection. Under pressure it is
+// shortened, but never below the length of a spoken wake word
+#define WAKE_WORD_PCM_HISTORY_MS 2000
+#define WAKE_WORD_PCM_HISTORY_MIN_MS 1500
+
+enum MemoryPressureLevel {
+    kMemoryPressureNormal,
+    kMemoryPressureLow,
+    kMemoryPressureCritical,
+};
+
+/*
+ * Tracks heap watermarks and decides how much the device should degrade:
+ * - Low: shrink audio queues and wake word buffers, defer chat bubbles and camera previews
+ * - Critical: shrink audio queues further, the wake word buffer stays at its minimum
+ */
+class MemoryPolicy {
+public:
+    static MemoryPolicy& GetInstance() {
+        static MemoryPolicy instance;
+        return instance;
+    }
+    MemoryPolicy(const MemoryPolicy&) = delete;
+    MemoryPolicy& operator=(const MemoryPolicy&) = delete;
+
+    // Re-evaluate the heap watermarks, returns true if the level changed
+    bool Update();
+
+    inline MemoryPressureLevel level() const { return level_; }
+    inline bool ShouldDeferNonCriticalWork() const { return level_ != kMemoryPressureNormal; }
+
+    static int GetWakeWordHistoryMs(MemoryPressureLevel level) {
+        return level == kMemoryPressureNormal ? WAKE_WORD_PCM_HISTORY_MS : WAKE_WORD_PCM_HISTORY_MIN_MS;
+    }
+
+private:
+    MemoryPolicy() = default;
+
+    std::atomic<MemoryPressureLevel> level_ = kMemoryPressureNormal;
+
+    MemoryPressureLevel GetLevel(size_t free_bytes, size_t low_bytes, size_t critical_bytes) const;
+};
+
+#endif // _MEMORY_POLICY_H_
@@ -0,0 +1,49 @@
+#include "network_sender.h"
+
+void NetworkSender::Post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void NetworkSender::NotifyAudio() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_pending_ = true;
+    }
+    cv_.notify_one();
+}
+
+void NetworkSender::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cv_.notify_one();
+}
+
+void NetworkSender::Run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopped_ || audio_pending_ || !tasks_.empty(); });
+            if (stopped_) {
+                return;
+            }
+            audio_pending_ = false;
+        }
+
+        // The send queue is bounded, while it is full the encoder stops taking new frames
+        do {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto tasks = std::move(tasks_);
+            tasks_.clear();
+            lock.unlock();
+            for (auto& task : tasks) {
+                task();
+            }
+        } while (send_audio_());
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef _NETWORK_SENDER_H_
+#define _NETWORK_SENDER_H_
+
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * The work queue of the network sender task. Everything that writes to the protocol is
+ * posted here, so a write that blocks on a slow link only ever stalls this task.
+ *
+ * Control tasks run in the order they were posted and ahead of queued audio: after every
+ * audio message the control tasks are checked again, audio only goes out when none are waiting.
+ */
+class NetworkSender {
+public:
+    // send_audio sends the next queued audio message, returns false if there was nothing
+    // to send or the send failed
+    explicit NetworkSender(std::function<bool()> send_audio) : send_audio_(std::move(send_audio)) {}
+
+    // Safe to call from any task, never waits for a send in progress
+    void Post(std::function<void()> task);
+    // New audio is waiting in the send queue
+    void NotifyAudio();
+    // The body of the sender task, returns after Stop()
+    void Run();
+    void Stop();
+
+private:
+    std::function<bool()> send_audio_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool audio_pending_ = false;
+    bool stopped_ = false;
+};
+
+#endif // _NETWORK_SENDER_H_
@@ -5,6 +5,7 @@
 
 #include "outfit_analyzer.h"
 #include "bocha_search.h"
+#include "json_arena.h"
 #include "board.h"
 #include <esp_log.h>
 #include <cJSON.h>
@@ -32,7 +33,8 @@ void OutfitAnalyzer::RegisterTools() {
         "3. 想了解自己的穿搭风格\n"
         "返回：详细的穿搭分析报告",
         PropertyList(),
-        DoOutfitAnalysis
+        DoOutfitAnalysis,
+        kMcpToolStackLarge
     );
     
     // 基于分析的推荐工具
@@ -49,7 +51,8 @@ void OutfitAnalyzer::RegisterTools() {
         PropertyList({
             Property("analysis_result", kPropertyTypeString, "")  // 可选参数
         }),
-        DoOutfitRecommendation
+        DoOutfitRecommendation,
+        kMcpToolStackLarge
     );
     
     // 完整的穿搭服务（分析+推荐）
@@ -63,7 +66,8 @@ void OutfitAnalyzer::RegisterTools() {
         "3. 想要购买配套衣物\n"
         "返回：穿搭分析 + 推荐衣物的完整报告",
         PropertyList(),
-        DoCompleteOutfitService
+        DoCompleteOutfitService,
+        kMcpToolStackLarge
     );
 
     ESP_LOGI(TAG, "Outfit analyzer tools registered successfully");
@@ -73,7 +77,7 @@ void OutfitAnalyzer::SetCamera(Camera* camera) {
     camera_ = camera;
 }
 
-OutfitAnalysis OutfitAnalyzer::AnalyzeCurrentOutfit() {
+OutfitAnalysis OutfitAnalyzer::AnalyzeCurrentOutfit(McpToolContext* context) {
     OutfitAnalysis result;
     result.success = false;
     
@@ -85,10 +89,17 @@ OutfitAnalysis OutfitAnalyzer::AnalyzeCurrentOutfit() {
     ESP_LOGI(TAG, "Starting outfit analysis...");
     
     // 拍照
+    if (context) {
+        context->ReportProgress(0, 3, "正在拍照");
+    }
     if (!camera_->Capture()) {
         result.message = "拍照失败，请检查相机";
         return result;
     }
+    if (context && context->ShouldStop()) {
+        result.message = "操作已取消或超时";
+        return result;
+    }
     
     // 构建专门用于穿搭分析的问题
     std::string outfit_question = 
@@ -102,6 +113,9 @@ OutfitAnalysis OutfitAnalyzer::AnalyzeCurrentOutfit() {
         "请用JSON格式回答，包含style, colors, items, season, occasion, suggestions等字段。";
     
     // 发送到相机AI分析
+    if (context) {
+        context->ReportProgress(1, 3, "正在分析穿搭");
+    }
     std::string camera_response = camera_->Explain(outfit_question);
     
     // 解析相机分析结果
@@ -118,7 +132,7 @@ OutfitAnalysis OutfitAnalyzer::AnalyzeCurrentOutfit() {
     return result;
 }
 
-OutfitRecommendation OutfitAnalyzer::RecommendOutfitItems(const OutfitAnalysis& analysis) {
+OutfitRecommendation OutfitAnalyzer::RecommendOutfitItems(const OutfitAnalysis& analysis, McpToolContext* context) {
     OutfitRecommendation result;
     result.success = false;
     
@@ -127,7 +141,15 @@ OutfitRecommendation OutfitAnalyzer::RecommendOutfitItems(const OutfitAnalysis&
         return result;
     }
     
+    if (context && context->ShouldStop()) {
+        result.message = "操作已取消或超时";
+        return result;
+    }
+    
     ESP_LOGI(TAG, "Starting outfit recommendation based on analysis...");
+    if (context) {
+        context->ReportProgress(2, 3, "正在搜索推荐单品");
+    }
     
     // 构建搜索查询
     std::string search_query = BuildRecommendationQuery(analysis);
@@ -161,17 +183,17 @@ OutfitRecommendation OutfitAnalyzer::RecommendOutfitItems(const OutfitAnalysis&
     return result;
 }
 
-std::string OutfitAnalyzer::AnalyzeAndRecommend() {
+std::string OutfitAnalyzer::AnalyzeAndRecommend(McpToolContext* context) {
     ESP_LOGI(TAG, "Starting complete outfit analysis and recommendation service");
     
     // 步骤1：分析当前穿搭
-    OutfitAnalysis analysis = AnalyzeCurrentOutfit();
+    OutfitAnalysis analysis = AnalyzeCurrentOutfit(context);
     if (!analysis.success) {
         return "{\"success\": false, \"message\": \"" + analysis.message + "\"}";
     }
     
     // 步骤2：基于分析结果推荐衣物
-    OutfitRecommendation recommendation = RecommendOutfitItems(analysis);
+    OutfitRecommendation recommendation = RecommendOutfitItems(analysis, context);
     
     // 构建完整的JSON响应
     cJSON* response = cJSON_CreateObject();
@@ -242,9 +264,9 @@ std::string OutfitAnalyzer::AnalyzeAndRecommend() {
 }
 
 // MCP工具实现函数
-ReturnValue OutfitAnalyzer::DoOutfitAnalysis(const PropertyList& properties) {
+ReturnValue OutfitAnalyzer::DoOutfitAnalysis(const PropertyList& properties, McpToolContext& context) {
     auto& analyzer = GetInstance();
-    OutfitAnalysis result = analyzer.AnalyzeCurrentOutfit();
+    OutfitAnalysis result = analyzer.AnalyzeCurrentOutfit(&context);
     
     if (!result.success) {
         return "{\"success\": false, \"message\": \"" + result.message + "\"}";
@@ -281,7 +303,7 @@ ReturnValue OutfitAnalyzer::DoOutfitAnalysis(const PropertyList& properties) {
     return result_str;
 }
 
-ReturnValue OutfitAnalyzer::DoOutfitRecommendation(const PropertyList& properties) {
+ReturnValue OutfitAnalyzer::DoOutfitRecommendation(const PropertyList& properties, McpToolContext& context) {
     auto& analyzer = GetInstance();
     
     // 检查是否提供了分析结果，如果没有则先进行分析
@@ -289,19 +311,19 @@ ReturnValue OutfitAnalyzer::DoOutfitRecommendation(const PropertyList& propertie
     
     OutfitAnalysis analysis;
     if (analysis_result.empty()) {
-        analysis = analyzer.AnalyzeCurrentOutfit();
+        analysis = analyzer.AnalyzeCurrentOutfit(&context);
         if (!analysis.success) {
             return "{\"success\": false, \"message\": \"" + analysis.message + "\"}";
         }
     } else {
         // 如果提供了分析结果，可以解析使用（这里简化处理）
-        analysis = analyzer.AnalyzeCurrentOutfit();
+        analysis = analyzer.AnalyzeCurrentOutfit(&context);
         if (!analysis.success) {
             return "{\"success\": false, \"message\": \"需要先进行穿搭分析\"}";
         }
     }
     
-    OutfitRecommendation recommendation = analyzer.RecommendOutfitItems(analysis);
+    OutfitRecommendation recommendation = analyzer.RecommendOutfitItems(analysis, &context);
     
     if (!recommendation.success) {
         return "{\"success\": false, \"message\": \"" + recommendation.message + "\"}";
@@ -336,13 +358,15 @@ ReturnValue OutfitAnalyzer::DoOutfitRecommendation(const PropertyList& propertie
     return result_str;
 }
 
-ReturnValue OutfitAnalyzer::DoCompleteOutfitService(const PropertyList& properties) {
+ReturnValue OutfitAnalyzer::DoCompleteOutfitService(const PropertyList& properties, McpToolContext& context) {
     auto& analyzer = GetInstance();
-    return analyzer.AnalyzeAndRecommend();
+    return analyzer.AnalyzeAndRecommend(&context);
 }
 
 // 内部辅助函数实现
 OutfitAnalysis OutfitAnalyzer::ParseCameraAnalysis(const std::string& camera_response) {
+    // cJSON 树只在本函数内有效，字段都拷贝进 OutfitAnalysis 的 std::string 成员后再返回
+    JsonArena arena(camera_response.length());
     OutfitAnalysis result;
     result.success = false;
     
@@ -517,6 +541,8 @@ std::string OutfitAnalyzer::BuildRecommendationQuery(const OutfitAnalysis& analy
 }
 
 OutfitRecommendation OutfitAnalyzer::ParseSearchResults(const std::string& search_response, const OutfitAnalysis& analysis) {
+    // 与 ParseCameraAnalysis 相同，推荐结果只保存拷贝，不保存 cJSON 节点
+    JsonArena arena(search_response.length());
     OutfitRecommendation result;
     result.success = false;
     
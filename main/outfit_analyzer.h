@@ -61,11 +61,11 @@ public:
     static void RegisterTools();
     
     // 核心功能
-    OutfitAnalysis AnalyzeCurrentOutfit();
-    OutfitRecommendation RecommendOutfitItems(const OutfitAnalysis& analysis);
+    OutfitAnalysis AnalyzeCurrentOutfit(McpToolContext* context = nullptr);
+    OutfitRecommendation RecommendOutfitItems(const OutfitAnalysis& analysis, McpToolContext* context = nullptr);
     
     // 完整的穿搭分析和推荐流程
-    std::string AnalyzeAndRecommend();
+    std::string AnalyzeAndRecommend(McpToolContext* context = nullptr);
     
     // 设置相机实例
     void SetCamera(Camera* camera);
@@ -79,9 +79,9 @@ private:
     OutfitAnalyzer& operator=(const OutfitAnalyzer&) = delete;
     
     // 内部工具函数
-    static ReturnValue DoOutfitAnalysis(const PropertyList& properties);
-    static ReturnValue DoOutfitRecommendation(const PropertyList& properties);
-    static ReturnValue DoCompleteOutfitService(const PropertyList& properties);
+    static ReturnValue DoOutfitAnalysis(const PropertyList& properties, McpToolContext& context);
+    static ReturnValue DoOutfitRecommendation(const PropertyList& properties, McpToolContext& context);
+    static ReturnValue DoCompleteOutfitService(const PropertyList& properties, McpToolContext& context);
     
     // 解析相机分析结果
     OutfitAnalysis ParseCameraAnalysis(const std::string& camera_response);
@@ -0,0 +1,58 @@
+#include "audio_bundle.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+size_t GetAudioBundleSize(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    size_t size = sizeof(uint8_t) + packets.size() * sizeof(uint16_t);
+    for (auto& packet : packets) {
+        size += packet->payload.size();
+    }
+    return size;
+}
+
+void EncodeAudioBundle(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets, uint8_t* output) {
+    output[0] = packets.size();
+    auto frame_sizes = output + sizeof(uint8_t);
+    auto frame_data = frame_sizes + packets.size() * sizeof(uint16_t);
+    for (size_t i = 0; i < packets.size(); i++) {
+        auto& payload = packets[i]->payload;
+        uint16_t frame_size = htons(payload.size());
+        memcpy(frame_sizes + i * sizeof(uint16_t), &frame_size, sizeof(frame_size));
+        memcpy(frame_data, payload.data(), payload.size());
+        frame_data += payload.size();
+    }
+}
+
+bool DecodeAudioBundle(const uint8_t* data, size_t size,
+    const std::function<void(int index, const uint8_t* frame, size_t frame_size)>& on_frame) {
+    if (size < sizeof(uint8_t)) {
+        return false;
+    }
+    int frame_count = data[0];
+    size_t header_size = sizeof(uint8_t) + frame_count * sizeof(uint16_t);
+    if (frame_count == 0 || size < header_size) {
+        return false;
+    }
+
+    auto frame_sizes = data + sizeof(uint8_t);
+    size_t total = header_size;
+    for (int i = 0; i < frame_count; i++) {
+        uint16_t frame_size;
+        memcpy(&frame_size, frame_sizes + i * sizeof(uint16_t), sizeof(frame_size));
+        total += ntohs(frame_size);
+    }
+    if (total != size) {
+        return false;
+    }
+
+    auto frame_data = data + header_size;
+    for (int i = 0; i < frame_count; i++) {
+        uint16_t frame_size;
+        memcpy(&frame_size, frame_sizes + i * sizeof(uint16_t), sizeof(frame_size));
+        frame_size = ntohs(frame_size);
+        on_frame(i, frame_data, frame_size);
+        frame_data += frame_size;
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef AUDIO_BUNDLE_H
+#define AUDIO_BUNDLE_H
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+/*
+ * Several Opus frames carried in one BinaryProtocol2/3 message with type kBinaryTypeOpusBundle.
+ *
+ * payload = frame_count (uint8_t)
+ *           frame_size[frame_count] (uint16_t, network byte order)
+ *           frame data, concatenated in order
+ *
+ * The timestamp of a BinaryProtocol2 header belongs to the first frame, frame i is
+ * timestamp + i * frame_duration.
+ */
+#define AUDIO_BUNDLE_MAX_FRAMES 8
+
+size_t GetAudioBundleSize(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets);
+void EncodeAudioBundle(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets, uint8_t* output);
+// Validates the whole bundle before calling on_frame for each frame, returns false if it is malformed
+bool DecodeAudioBundle(const uint8_t* data, size_t size,
+    const std::function<void(int index, const uint8_t* frame, size_t frame_size)>& on_frame);
+
+#endif // AUDIO_BUNDLE_H
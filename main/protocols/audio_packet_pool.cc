@@ -0,0 +1,49 @@
+#include "audio_packet_pool.h"
+
+AudioPacketPool::AudioPacketPool() {
+    // Release never grows the vector itself
+    packets_.reserve(AUDIO_PACKET_POOL_SIZE);
+}
+
+std::unique_ptr<AudioStreamPacket> AudioPacketPool::Acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics_.acquired++;
+        if (!packets_.empty()) {
+            auto packet = std::move(packets_.back());
+            packets_.pop_back();
+            statistics_.reused++;
+            return packet;
+        }
+    }
+    return std::make_unique<AudioStreamPacket>();
+}
+
+void AudioPacketPool::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    if (packet == nullptr || packet->payload.capacity() > AUDIO_PACKET_POOL_MAX_PAYLOAD) {
+        return;
+    }
+    packet->sample_rate = 0;
+    packet->frame_duration = 0;
+    packet->timestamp = 0;
+    packet->payload.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (packets_.size() < AUDIO_PACKET_POOL_SIZE) {
+        packets_.push_back(std::move(packet));
+    }
+}
+
+void AudioPacketPool::Clear() {
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    packets.reserve(AUDIO_PACKET_POOL_SIZE);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        packets.swap(packets_);
+    }
+}
+
+AudioPacketPoolStatistics AudioPacketPool::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
@@ -0,0 +1,55 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+// Packets kept for reuse, about one second of 60 ms frames
+#define AUDIO_PACKET_POOL_SIZE 16
+// Packets whose payload storage grew beyond this are freed instead of kept
+#define AUDIO_PACKET_POOL_MAX_PAYLOAD 1500
+
+struct AudioPacketPoolStatistics {
+    uint32_t acquired = 0;
+    uint32_t reused = 0;
+};
+
+/*
+ * Recycles incoming audio packets together with their payload storage.
+ *
+ * The protocols take a packet from the pool for every received frame and write the payload
+ * into it, the decoder gives the packet back once the frame is decoded. After the first
+ * second of a reply, receiving a frame allocates nothing. Packets that are dropped on the
+ * way are freed as usual, the pool simply allocates a new one next time.
+ */
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    // The payload is empty but keeps the capacity of its previous use
+    std::unique_ptr<AudioStreamPacket> Acquire();
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    // Frees the pooled packets, e.g. under memory pressure
+    void Clear();
+
+    AudioPacketPoolStatistics statistics();
+
+private:
+    AudioPacketPool();
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets_;
+    AudioPacketPoolStatistics statistics_;
+};
+
+#endif // AUDIO_PACKET_POOL_H
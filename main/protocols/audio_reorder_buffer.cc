@@ -0,0 +1,139 @@
+#include "audio_reorder_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "AudioReorder"
+
+void AudioReorderBuffer::Reset(size_t window_packets, int window_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_packets_ = window_packets;
+    window_us_ = window_ms * 1000LL;
+    started_ = false;
+    next_sequence_ = 0;
+    released_mask_ = 0;
+    pending_.clear();
+    ready_.clear();
+    statistics_ = AudioReorderStatistics();
+}
+
+AudioReorderStatistics AudioReorderBuffer::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void AudioReorderBuffer::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    next_sequence_++;
+    released_mask_ = (released_mask_ << 1) | 1;
+    statistics_.released++;
+    ready_.push_back(std::move(packet));
+}
+
+// Runs the callback for the released packets without holding the lock
+void AudioReorderBuffer::Deliver(std::unique_lock<std::mutex>& lock, const ReleaseCallback& release) {
+    if (delivering_) {
+        // Another task is delivering and picks up the packets released here
+        return;
+    }
+    delivering_ = true;
+    while (!ready_.empty()) {
+        auto packet = std::move(ready_.front());
+        ready_.pop_front();
+        lock.unlock();
+        release(std::move(packet));
+        lock.lock();
+    }
+    delivering_ = false;
+}
+
+void AudioReorderBuffer::Skip(uint32_t count) {
+    statistics_.lost += count;
+    next_sequence_ += count;
+    released_mask_ = count >= 64 ? 0 : released_mask_ << count;
+}
+
+// Give up waiting for the packets in front of the first pending one
+void AudioReorderBuffer::SkipToFirstPending(const char* reason) {
+    auto first = pending_.begin()->first;
+    ESP_LOGW(TAG, "Lost audio packets (%s): %lu - %lu", reason, next_sequence_, first - 1);
+    Skip(first - next_sequence_);
+}
+
+void AudioReorderBuffer::ReleaseInOrder() {
+    while (!pending_.empty() && pending_.begin()->first == next_sequence_) {
+        auto node = pending_.extract(pending_.begin());
+        Release(std::move(node.mapped().packet));
+    }
+}
+
+void AudioReorderBuffer::ReleaseExpiredLocked(int64_t now) {
+    while (!pending_.empty()) {
+        int64_t oldest_arrival_time_us = now;
+        for (auto& item : pending_) {
+            oldest_arrival_time_us = std::min(oldest_arrival_time_us, item.second.arrival_time_us);
+        }
+        if (now - oldest_arrival_time_us < window_us_) {
+            return;
+        }
+        SkipToFirstPending("timeout");
+        ReleaseInOrder();
+    }
+}
+
+void AudioReorderBuffer::ReleaseExpired(const ReleaseCallback& release) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ReleaseExpiredLocked(esp_timer_get_time());
+    Deliver(lock, release);
+}
+
+void AudioReorderBuffer::Flush(const ReleaseCallback& release) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!pending_.empty()) {
+        SkipToFirstPending("flush");
+        ReleaseInOrder();
+    }
+    Deliver(lock, release);
+}
+
+void AudioReorderBuffer::Push(uint32_t sequence, std::unique_ptr<AudioStreamPacket> packet, const ReleaseCallback& release) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    statistics_.received++;
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+    }
+
+    if (sequence < next_sequence_) {
+        uint32_t distance = next_sequence_ - 1 - sequence;
+        if (distance < 64 && (released_mask_ & (1ULL << distance))) {
+            statistics_.duplicate++;
+        } else {
+            statistics_.late++;
+            ESP_LOGW(TAG, "Late audio packet: %lu, expected: %lu", sequence, next_sequence_);
+        }
+        return;
+    }
+
+    if (sequence > next_sequence_) {
+        if (!pending_.emplace(sequence, PendingPacket{std::move(packet), now}).second) {
+            statistics_.duplicate++;
+            return;
+        }
+        if (pending_.size() > window_packets_) {
+            // The window is full, give up waiting for the missing packets
+            SkipToFirstPending("window full");
+        }
+    } else {
+        if (!pending_.empty()) {
+            statistics_.reordered++;
+        }
+        Release(std::move(packet));
+    }
+
+    // Release the packets that are now in order, then the ones that waited too long
+    ReleaseInOrder();
+    ReleaseExpiredLocked(now);
+    Deliver(lock, release);
+}
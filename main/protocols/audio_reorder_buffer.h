@@ -0,0 +1,72 @@
+#ifndef AUDIO_REORDER_BUFFER_H
+#define AUDIO_REORDER_BUFFER_H
+
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+#include "protocol.h"
+
+struct AudioReorderStatistics {
+    uint32_t received = 0;
+    uint32_t released = 0;
+    uint32_t reordered = 0;     // Arrived after a later packet, still released in order
+    uint32_t lost = 0;          // Skipped because the window was full or the wait timed out
+    uint32_t late = 0;          // Arrived after its sequence had already been skipped
+    uint32_t duplicate = 0;     // Already released or already waiting in the window
+};
+
+/*
+ * Holds out-of-order audio packets for a small window and releases them in sequence order.
+ * When more than window_packets packets are waiting for a missing one, or the oldest waiting
+ * packet has waited longer than window_ms, the missing packets are counted as lost and skipped.
+ * Waiting packets are only checked when a packet arrives, so the owner calls ReleaseExpired
+ * periodically and Flush at the end of a stream, or the tail of a reply stays in the buffer.
+ *
+ * All methods may be called from different tasks. Packets are collected under the lock and the
+ * release callback runs after it is dropped, so the callback may call statistics(). When two
+ * tasks release packets at the same time, the one already delivering also delivers the packets
+ * of the other, in order, so every caller must pass an equivalent callback.
+ */
+class AudioReorderBuffer {
+public:
+    using ReleaseCallback = std::function<void(std::unique_ptr<AudioStreamPacket> packet)>;
+
+    void Reset(size_t window_packets, int window_ms);
+    void Push(uint32_t sequence, std::unique_ptr<AudioStreamPacket> packet, const ReleaseCallback& release);
+    // Skip the missing packets that have been waited for longer than window_ms
+    void ReleaseExpired(const ReleaseCallback& release);
+    // Release everything that is waiting, skipping the missing packets
+    void Flush(const ReleaseCallback& release);
+
+    AudioReorderStatistics statistics();
+
+private:
+    struct PendingPacket {
+        std::unique_ptr<AudioStreamPacket> packet;
+        int64_t arrival_time_us;
+    };
+
+    std::mutex mutex_;
+    size_t window_packets_ = 0;
+    int64_t window_us_ = 0;
+    bool started_ = false;
+    uint32_t next_sequence_ = 0;
+    uint64_t released_mask_ = 0;    // Bit i is set if next_sequence_ - 1 - i was released
+    std::map<uint32_t, PendingPacket> pending_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> ready_;  // Released, waiting for the callback
+    bool delivering_ = false;
+    AudioReorderStatistics statistics_;
+
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    void Skip(uint32_t count);
+    void SkipToFirstPending(const char* reason);
+    void ReleaseInOrder();
+    void ReleaseExpiredLocked(int64_t now);
+    void Deliver(std::unique_lock<std::mutex>& lock, const ReleaseCallback& release);
+};
+
+#endif // AUDIO_REORDER_BUFFER_H
@@ -0,0 +1,65 @@
+#include "binary_protocol.h"
+
+#include <arpa/inet.h>
+
+bool ParseBinaryMessage(int version, const uint8_t* data, size_t len, BinaryMessage& message) {
+    message = BinaryMessage();
+    message.payload = data;
+    message.payload_size = len;
+
+    // No header field is read before the length check, a short frame must not be dereferenced
+    if (version == 2) {
+        if (len < sizeof(BinaryProtocol2)) {
+            return false;
+        }
+        auto bp2 = (const BinaryProtocol2*)data;
+        message.payload_size = ntohl(bp2->payload_size);
+        if (message.payload_size > len - sizeof(BinaryProtocol2)) {
+            return false;
+        }
+        message.type = ntohs(bp2->type);
+        message.timestamp = ntohl(bp2->timestamp);
+        message.payload = bp2->payload;
+    } else if (version == 3) {
+        if (len < sizeof(BinaryProtocol3)) {
+            return false;
+        }
+        auto bp3 = (const BinaryProtocol3*)data;
+        message.payload_size = ntohs(bp3->payload_size);
+        if (message.payload_size > len - sizeof(BinaryProtocol3)) {
+            return false;
+        }
+        message.type = bp3->type;
+        message.payload = bp3->payload;
+    }
+    return true;
+}
+
+uint8_t* WriteBinaryHeader(int version, int type, uint32_t timestamp, size_t payload_size, std::string& output) {
+    if (version == 2) {
+        output.resize(sizeof(BinaryProtocol2) + payload_size);
+        auto bp2 = (BinaryProtocol2*)output.data();
+        bp2->version = htons(version);
+        bp2->type = htons(type);
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(timestamp);
+        bp2->payload_size = htonl(payload_size);
+        return bp2->payload;
+    } else if (version == 3) {
+        if (payload_size > UINT16_MAX) {
+            return nullptr;
+        }
+        output.resize(sizeof(BinaryProtocol3) + payload_size);
+        auto bp3 = (BinaryProtocol3*)output.data();
+        bp3->type = type;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload_size);
+        return bp3->payload;
+    }
+    // Version 1 carries Opus frames only, without a header
+    if (type != kBinaryTypeOpus) {
+        return nullptr;
+    }
+    output.resize(payload_size);
+    return (uint8_t*)output.data();
+}
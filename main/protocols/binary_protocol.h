@@ -0,0 +1,30 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+/*
+ * Framing of WebSocket binary messages. Version 1 is the bare payload, versions 2 and 3
+ * prefix it with BinaryProtocol2 / BinaryProtocol3 (protocol.h).
+ */
+
+// A received message, payload points into the received data
+struct BinaryMessage {
+    int type = kBinaryTypeOpus;
+    uint32_t timestamp = 0;
+    const uint8_t* payload = nullptr;
+    size_t payload_size = 0;
+};
+
+// Reads the header in place, returns false if the message is shorter than its header says
+bool ParseBinaryMessage(int version, const uint8_t* data, size_t len, BinaryMessage& message);
+
+// Resizes output to the header plus payload_size bytes and writes the header at its front.
+// Returns where the payload goes, or nullptr if the payload does not fit the header of this version
+uint8_t* WriteBinaryHeader(int version, int type, uint32_t timestamp, size_t payload_size, std::string& output);
+
+#endif // BINARY_PROTOCOL_H
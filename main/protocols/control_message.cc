@@ -0,0 +1,172 @@
+#include "control_message.h"
+#include "fnv1a.h"
+
+namespace {
+
+// The hashes are computed at compile time, the string compare guards against collisions
+ControlMessageType LookupType(std::string_view type) {
+    switch (Fnv1a(type)) {
+    case Fnv1a("tts"):
+        return type == "tts" ? kControlMessageTts : kControlMessageUnknown;
+    case Fnv1a("stt"):
+        return type == "stt" ? kControlMessageStt : kControlMessageUnknown;
+    case Fnv1a("llm"):
+        return type == "llm" ? kControlMessageLlm : kControlMessageUnknown;
+    default:
+        return kControlMessageUnknown;
+    }
+}
+
+class Scanner {
+public:
+    Scanner(const char* data, size_t len) : p_(data), end_(data + len) {}
+
+    void SkipSpace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+            p_++;
+        }
+    }
+
+    bool Consume(char c) {
+        SkipSpace();
+        if (p_ < end_ && *p_ == c) {
+            p_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool AtEnd() {
+        SkipSpace();
+        return p_ == end_;
+    }
+
+    char Peek() {
+        SkipSpace();
+        return p_ < end_ ? *p_ : '\0';
+    }
+
+    // Reads a string without escapes as a view, sets escaped if it had any
+    bool ReadString(std::string_view& value, bool& escaped) {
+        if (!Consume('"')) {
+            return false;
+        }
+        auto start = p_;
+        escaped = false;
+        while (p_ < end_ && *p_ != '"') {
+            if (*p_ == '\\') {
+                escaped = true;
+                // A backslash at the end of the data has nothing to escape
+                if (p_ + 1 >= end_) {
+                    return false;
+                }
+                p_++;
+            }
+            p_++;
+        }
+        if (p_ >= end_) {
+            return false;
+        }
+        value = std::string_view(start, p_ - start);
+        p_++;
+        return true;
+    }
+
+    // Skips a number, literal, object or array
+    bool SkipValue() {
+        SkipSpace();
+        if (p_ >= end_) {
+            return false;
+        }
+        if (*p_ == '"') {
+            std::string_view value;
+            bool escaped;
+            return ReadString(value, escaped);
+        }
+        if (*p_ != '{' && *p_ != '[') {
+            while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' &&
+                   *p_ != ' ' && *p_ != '\t' && *p_ != '\n' && *p_ != '\r') {
+                p_++;
+            }
+            return true;
+        }
+
+        int depth = 0;
+        while (p_ < end_) {
+            char c = *p_;
+            if (c == '"') {
+                std::string_view value;
+                bool escaped;
+                if (!ReadString(value, escaped)) {
+                    return false;
+                }
+                continue;
+            }
+            p_++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+} // namespace
+
+bool ParseControlMessage(const char* data, size_t len, ControlMessage& message) {
+    message = ControlMessage();
+    Scanner scanner(data, len);
+    if (!scanner.Consume('{')) {
+        return false;
+    }
+
+    std::string_view type;
+    if (!scanner.Consume('}')) {
+        do {
+            std::string_view key;
+            bool escaped;
+            if (!scanner.ReadString(key, escaped) || escaped || !scanner.Consume(':')) {
+                return false;
+            }
+
+            std::string_view* field = nullptr;
+            if (key == "type") {
+                field = &type;
+            } else if (key == "state") {
+                field = &message.state;
+            } else if (key == "text") {
+                field = &message.text;
+            } else if (key == "emotion") {
+                field = &message.emotion;
+            }
+
+            if (field != nullptr && scanner.Peek() == '"') {
+                if (!scanner.ReadString(*field, escaped) || escaped) {
+                    return false;
+                }
+            } else if (!scanner.SkipValue()) {
+                return false;
+            }
+        } while (scanner.Consume(','));
+
+        if (!scanner.Consume('}')) {
+            return false;
+        }
+    }
+
+    // Trailing NUL bytes are allowed, some transports count the terminator in the length
+    if (!scanner.AtEnd() && scanner.Peek() != '\0') {
+        return false;
+    }
+
+    message.type = LookupType(type);
+    return message.type != kControlMessageUnknown;
+}
@@ -0,0 +1,31 @@
+#ifndef CONTROL_MESSAGE_H
+#define CONTROL_MESSAGE_H
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+enum ControlMessageType {
+    kControlMessageUnknown,
+    kControlMessageTts,
+    kControlMessageStt,
+    kControlMessageLlm,
+};
+
+// The hot fields of a server control message. The views point into the received text,
+// a field that is not present has a null data().
+struct ControlMessage {
+    ControlMessageType type = kControlMessageUnknown;
+    std::string_view state;
+    std::string_view text;
+    std::string_view emotion;
+};
+
+/*
+ * Pulls type, state, text and emotion out of a JSON object without building a tree or
+ * allocating. Returns false when the message is not one of the hot types, is not a valid
+ * object, or one of the fields contains escape sequences; the caller then falls back to cJSON.
+ */
+bool ParseControlMessage(const char* data, size_t len, ControlMessage& message);
+
+#endif // CONTROL_MESSAGE_H
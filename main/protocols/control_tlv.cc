@@ -0,0 +1,69 @@
+#include "control_tlv.h"
+
+ControlTlvWriter::ControlTlvWriter(std::string& output, ControlTlvType type) : output_(output) {
+    output_.clear();
+    output_.push_back(type);
+}
+
+void ControlTlvWriter::Add(ControlTlvTag tag, std::string_view value) {
+    output_.push_back(tag);
+    size_t length = value.size();
+    do {
+        uint8_t byte = length & 0x7F;
+        length >>= 7;
+        output_.push_back(length != 0 ? (byte | 0x80) : byte);
+    } while (length != 0);
+    output_.append(value);
+}
+
+bool DecodeControlTlv(const uint8_t* data, size_t size, ControlMessage& message) {
+    message = ControlMessage();
+    if (size < 1) {
+        return false;
+    }
+    switch (data[0]) {
+    case kControlTlvTts:
+        message.type = kControlMessageTts;
+        break;
+    case kControlTlvStt:
+        message.type = kControlMessageStt;
+        break;
+    case kControlTlvLlm:
+        message.type = kControlMessageLlm;
+        break;
+    default:
+        return false;
+    }
+
+    size_t offset = 1;
+    while (offset < size) {
+        uint8_t tag = data[offset++];
+        size_t length = 0;
+        int shift = 0;
+        while (true) {
+            if (offset >= size || shift > 28) {
+                return false;
+            }
+            uint8_t byte = data[offset++];
+            length |= (size_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+        }
+        if (length > size - offset) {
+            return false;
+        }
+
+        std::string_view value((const char*)data + offset, length);
+        offset += length;
+        if (tag == kControlTlvState) {
+            message.state = value;
+        } else if (tag == kControlTlvText) {
+            message.text = value;
+        } else if (tag == kControlTlvEmotion) {
+            message.emotion = value;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef CONTROL_TLV_H
+#define CONTROL_TLV_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+#include "control_message.h"
+
+/*
+ * Compact binary form of the hot control messages, negotiated with features.control_tlv.
+ *
+ * message = type (uint8_t), then fields until the end of the message
+ * field   = tag (uint8_t), length (unsigned LEB128), value (UTF-8 bytes)
+ *
+ * Field values carry the same strings as the JSON members of the same name, so
+ * {"type":"listen","state":"start","mode":"auto"} becomes
+ * 01 | 02 05 "start" | 03 04 "auto".
+ */
+enum ControlTlvType : uint8_t {
+    kControlTlvListen = 1,
+    kControlTlvAbort = 2,
+    kControlTlvTts = 3,
+    kControlTlvStt = 4,
+    kControlTlvLlm = 5,
+};
+
+enum ControlTlvTag : uint8_t {
+    kControlTlvSessionId = 1,
+    kControlTlvState = 2,
+    kControlTlvMode = 3,
+    kControlTlvText = 4,
+    kControlTlvReason = 5,
+    kControlTlvEmotion = 6,
+};
+
+class ControlTlvWriter {
+public:
+    // Clears output and starts a message of the given type
+    ControlTlvWriter(std::string& output, ControlTlvType type);
+
+    void Add(ControlTlvTag tag, std::string_view value);
+
+private:
+    std::string& output_;
+};
+
+// Decodes a tts, stt or llm message, the views point into data
+bool DecodeControlTlv(const uint8_t* data, size_t size, ControlMessage& message);
+
+#endif // CONTROL_TLV_H
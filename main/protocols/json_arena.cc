@@ -0,0 +1,157 @@
+#include "json_arena.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "JsonArena"
+
+// cJSON allocations are a mix of pointers and strings, keep everything pointer-aligned
+#define JSON_ARENA_ALIGNMENT 8
+
+thread_local JsonArena* JsonArena::current_ = nullptr;
+
+#ifndef NDEBUG
+// Chunks of the arenas alive on any thread. A block from one of them that reaches
+// HookFree on a thread that does not own it escaped its arena, and free() would
+// corrupt the heap, so debug builds stop right there instead.
+static std::mutex g_live_chunks_mutex;
+static std::vector<std::pair<const uint8_t*, const uint8_t*>> g_live_chunks;
+
+static void AddLiveChunk(const uint8_t* begin, size_t size) {
+    std::lock_guard<std::mutex> lock(g_live_chunks_mutex);
+    g_live_chunks.emplace_back(begin, begin + size);
+}
+
+static void RemoveLiveChunk(const uint8_t* begin) {
+    std::lock_guard<std::mutex> lock(g_live_chunks_mutex);
+    auto it = std::find_if(g_live_chunks.begin(), g_live_chunks.end(),
+        [begin](const auto& chunk) { return chunk.first == begin; });
+    if (it != g_live_chunks.end()) {
+        *it = g_live_chunks.back();
+        g_live_chunks.pop_back();
+    }
+}
+
+static bool InLiveChunk(const void* ptr) {
+    std::lock_guard<std::mutex> lock(g_live_chunks_mutex);
+    for (auto& chunk : g_live_chunks) {
+        if (ptr >= chunk.first && ptr < chunk.second) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+void JsonArena::InstallHooks() {
+    cJSON_Hooks hooks = {
+        .malloc_fn = HookMalloc,
+        .free_fn = HookFree,
+    };
+    cJSON_InitHooks(&hooks);
+}
+
+JsonArena::JsonArena(size_t size_hint) : previous_(current_) {
+    // A parsed tree takes a few times the size of its text
+    next_chunk_size_ = std::max<size_t>(JSON_ARENA_MIN_CHUNK_SIZE, size_hint * 3);
+    caps_ = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+#if CONFIG_SPIRAM
+    if (size_hint > JSON_ARENA_PSRAM_THRESHOLD) {
+        caps_ = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    }
+#endif
+    current_ = this;
+}
+
+JsonArena::~JsonArena() {
+    current_ = previous_;
+
+    size_t chunk_count = 0;
+    size_t chunk_bytes = 0;
+    while (chunks_ != nullptr) {
+        auto next = chunks_->next;
+        chunk_count++;
+        chunk_bytes += chunks_->size;
+#ifndef NDEBUG
+        RemoveLiveChunk((const uint8_t*)(chunks_ + 1));
+#endif
+        heap_caps_free(chunks_);
+        chunks_ = next;
+    }
+    ESP_LOGD(TAG, "%lu allocations, %u bytes in %u chunks (%u bytes)", (unsigned long)allocations_,
+        (unsigned)allocated_bytes_, (unsigned)chunk_count, (unsigned)chunk_bytes);
+}
+
+JsonArena::Chunk* JsonArena::AddChunk(size_t min_size) {
+    size_t size = std::max(next_chunk_size_, min_size);
+    auto chunk = (Chunk*)heap_caps_malloc(sizeof(Chunk) + size, caps_);
+    if (chunk == nullptr && caps_ != MALLOC_CAP_8BIT) {
+        // Fall back to any memory rather than failing the parse
+        chunk = (Chunk*)heap_caps_malloc(sizeof(Chunk) + size, MALLOC_CAP_8BIT);
+    }
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    chunk->next = chunks_;
+    chunk->size = size;
+    chunk->used = 0;
+    chunks_ = chunk;
+    next_chunk_size_ = size * 2;
+#ifndef NDEBUG
+    AddLiveChunk((const uint8_t*)(chunk + 1), size);
+#endif
+    return chunk;
+}
+
+void* JsonArena::Allocate(size_t size) {
+    size = (size + JSON_ARENA_ALIGNMENT - 1) & ~(size_t)(JSON_ARENA_ALIGNMENT - 1);
+    auto chunk = chunks_;
+    if (chunk == nullptr || chunk->size - chunk->used < size) {
+        chunk = AddChunk(size);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+    }
+    void* ptr = (uint8_t*)(chunk + 1) + chunk->used;
+    chunk->used += size;
+    allocations_++;
+    allocated_bytes_ += size;
+    return ptr;
+}
+
+bool JsonArena::Owns(const void* ptr) const {
+    for (auto chunk = chunks_; chunk != nullptr; chunk = chunk->next) {
+        auto begin = (const uint8_t*)(chunk + 1);
+        if (ptr >= begin && ptr < begin + chunk->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void* JsonArena::HookMalloc(size_t size) {
+    if (current_ != nullptr) {
+        return current_->Allocate(size);
+    }
+    return malloc(size);
+}
+
+void JsonArena::HookFree(void* ptr) {
+    // Blocks from the arenas open on this thread are released with their arena
+    for (auto arena = current_; arena != nullptr; arena = arena->previous_) {
+        if (arena->Owns(ptr)) {
+            return;
+        }
+    }
+#ifndef NDEBUG
+    // A block of an arena that is open on another thread
+    assert(ptr == nullptr || !InLiveChunk(ptr));
+#endif
+    free(ptr);
+}
@@ -0,0 +1,64 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Messages larger than this are parsed in PSRAM when it is available
+#define JSON_ARENA_PSRAM_THRESHOLD 4096
+#define JSON_ARENA_MIN_CHUNK_SIZE 1024
+
+/*
+ * Bump allocator for cJSON, installed through cJSON_InitHooks.
+ *
+ * While a JsonArena is alive on the current thread, every cJSON allocation on
+ * that thread is carved out of the arena and cJSON_Delete/cJSON_free of those
+ * blocks does nothing, the whole arena is released in one shot when it goes
+ * out of scope. Without an arena the hooks fall back to malloc/free.
+ *
+ *   JsonArena arena(message.size());
+ *   cJSON* root = cJSON_Parse(message.c_str());
+ *   ...
+ *   cJSON_Delete(root);
+ *
+ * Trees and printed strings created inside the scope must not outlive it, or
+ * be freed from another thread. Copy what has to be kept into std::string or
+ * other owned storage before the scope ends. Debug builds assert when a block
+ * of an arena open on another thread is freed.
+ */
+class JsonArena {
+public:
+    // size_hint is the size of the JSON text about to be parsed
+    explicit JsonArena(size_t size_hint);
+    ~JsonArena();
+    JsonArena(const JsonArena&) = delete;
+    JsonArena& operator=(const JsonArena&) = delete;
+
+    // Called once at startup, before any arena is used
+    static void InstallHooks();
+
+private:
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+        size_t used;
+    };
+
+    void* Allocate(size_t size);
+    bool Owns(const void* ptr) const;
+    Chunk* AddChunk(size_t min_size);
+
+    static void* HookMalloc(size_t size);
+    static void HookFree(void* ptr);
+
+    Chunk* chunks_ = nullptr;
+    JsonArena* previous_;
+    size_t next_chunk_size_;
+    uint32_t caps_;
+    uint32_t allocations_ = 0;
+    size_t allocated_bytes_ = 0;
+
+    static thread_local JsonArena* current_;
+};
+
+#endif // JSON_ARENA_H
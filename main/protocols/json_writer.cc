@@ -0,0 +1,120 @@
+#include "json_writer.h"
+
+JsonWriter& JsonWriter::Reserve(size_t size) {
+    output_.reserve(output_.size() + size);
+    return *this;
+}
+
+void JsonWriter::BeforeValue() {
+    if (need_comma_) {
+        output_ += ',';
+    }
+    need_comma_ = true;
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    BeforeValue();
+    output_ += '{';
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    output_ += '}';
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    BeforeValue();
+    output_ += '[';
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    output_ += ']';
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    BeforeValue();
+    AppendEscaped(output_, key);
+    output_ += ':';
+    // The value that follows the key must not be preceded by a comma
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    BeforeValue();
+    AppendEscaped(output_, value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    BeforeValue();
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    output_.append(p, end - p);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    BeforeValue();
+    output_ += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+    BeforeValue();
+    output_ += "null";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    BeforeValue();
+    output_.append(json.data(), json.size());
+    return *this;
+}
+
+void JsonWriter::AppendEscaped(std::string& output, std::string_view value) {
+    static const char kHex[] = "0123456789abcdef";
+    output += '"';
+    // Copy runs of characters that need no escaping in one append
+    size_t run_start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        uint8_t c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        output.append(value.data() + run_start, i - run_start);
+        run_start = i + 1;
+        switch (c) {
+        case '"': output += "\\\""; break;
+        case '\\': output += "\\\\"; break;
+        case '\b': output += "\\b"; break;
+        case '\f': output += "\\f"; break;
+        case '\n': output += "\\n"; break;
+        case '\r': output += "\\r"; break;
+        case '\t': output += "\\t"; break;
+        default:
+            output += "\\u00";
+            output += kHex[c >> 4];
+            output += kHex[c & 0x0f];
+            break;
+        }
+    }
+    output.append(value.data() + run_start, value.size() - run_start);
+    output += '"';
+}
@@ -0,0 +1,57 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+/*
+ * Appends JSON to a caller-owned std::string without building a cJSON tree.
+ *
+ * String values and keys are escaped, Raw() embeds text that is already JSON
+ * (a tool result, a tools/list entry). Commas are inserted automatically, so
+ *
+ *   JsonWriter writer(message);
+ *   writer.BeginObject().Field("type", "listen").Field("state", "stop").EndObject();
+ *
+ * produces {"type":"listen","state":"stop"}. Reserve() the expected size up
+ * front to build a message with a single allocation.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& output) : output_(output) {}
+
+    JsonWriter& Reserve(size_t size);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+    JsonWriter& Raw(std::string_view json);
+
+    JsonWriter& Field(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    // A null C string is written as JSON null
+    JsonWriter& Field(std::string_view key, const char* value) {
+        return value != nullptr ? Key(key).String(value) : Key(key).Null();
+    }
+    JsonWriter& Field(std::string_view key, int value) { return Key(key).Int(value); }
+    JsonWriter& Field(std::string_view key, bool value) { return Key(key).Bool(value); }
+    JsonWriter& RawField(std::string_view key, std::string_view json) { return Key(key).Raw(json); }
+
+    // Appends value as a quoted JSON string literal
+    static void AppendEscaped(std::string& output, std::string_view value);
+
+private:
+    void BeforeValue();
+
+    std::string& output_;
+    bool need_comma_ = false;
+};
+
+#endif // JSON_WRITER_H
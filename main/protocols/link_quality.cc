@@ -0,0 +1,86 @@
+#include "link_quality.h"
+
+#include <cstdlib>
+
+// Loss is averaged over blocks of this many packets
+#define LINK_QUALITY_LOSS_BLOCK_PACKETS 50
+#define LINK_QUALITY_THROUGHPUT_WINDOW_MS 1000
+
+void LinkQualityEstimator::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quality_ = LinkQuality();
+    last_received_ = 0;
+    last_lost_ = 0;
+    tx_bytes_ = 0;
+    rx_bytes_ = 0;
+    window_start_ = std::chrono::steady_clock::now();
+}
+
+void LinkQualityEstimator::OnRttSample(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (quality_.rtt_ms < 0) {
+        quality_.rtt_ms = rtt_ms;
+        quality_.rtt_variation_ms = rtt_ms / 2;
+        return;
+    }
+    // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+    quality_.rtt_variation_ms = (3 * quality_.rtt_variation_ms + std::abs(quality_.rtt_ms - rtt_ms)) / 4;
+    quality_.rtt_ms = (7 * quality_.rtt_ms + rtt_ms) / 8;
+}
+
+void LinkQualityEstimator::OnPacketCounters(uint32_t received, uint32_t lost) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (received < last_received_ || lost < last_lost_) {
+        // The counters were reset with a new channel
+        last_received_ = 0;
+        last_lost_ = 0;
+    }
+    uint32_t new_received = received - last_received_;
+    uint32_t new_lost = lost - last_lost_;
+    if (new_received + new_lost < LINK_QUALITY_LOSS_BLOCK_PACKETS) {
+        return;
+    }
+    last_received_ = received;
+    last_lost_ = lost;
+
+    float block_loss = (float)new_lost / (new_received + new_lost);
+    quality_.loss_rate = 0.75f * quality_.loss_rate + 0.25f * block_loss;
+}
+
+void LinkQualityEstimator::OnBytesSent(size_t bytes) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    tx_bytes_ += bytes;
+    UpdateThroughput(now);
+}
+
+void LinkQualityEstimator::OnBytesReceived(size_t bytes) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    rx_bytes_ += bytes;
+    UpdateThroughput(now);
+}
+
+void LinkQualityEstimator::OnSendTime(int send_time_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quality_.send_time_ms = (7 * quality_.send_time_ms + send_time_ms) / 8;
+}
+
+LinkQuality LinkQualityEstimator::Get() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    UpdateThroughput(now);
+    return quality_;
+}
+
+void LinkQualityEstimator::UpdateThroughput(std::chrono::steady_clock::time_point now) {
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start_).count();
+    if (elapsed_ms < LINK_QUALITY_THROUGHPUT_WINDOW_MS) {
+        return;
+    }
+    quality_.tx_bytes_per_second = tx_bytes_ * 1000 / elapsed_ms;
+    quality_.rx_bytes_per_second = rx_bytes_ * 1000 / elapsed_ms;
+    tx_bytes_ = 0;
+    rx_bytes_ = 0;
+    window_start_ = now;
+}
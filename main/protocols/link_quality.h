@@ -0,0 +1,49 @@
+#ifndef LINK_QUALITY_H
+#define LINK_QUALITY_H
+
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+struct LinkQuality {
+    int rtt_ms = -1;                    // Smoothed round trip time, -1 until the first sample
+    int rtt_variation_ms = 0;
+    float loss_rate = 0.0f;             // Smoothed fraction of incoming audio packets lost
+    uint32_t tx_bytes_per_second = 0;
+    uint32_t rx_bytes_per_second = 0;
+    int send_time_ms = 0;               // Smoothed time a blocking send takes to return
+};
+
+/*
+ * Builds a LinkQuality from samples the protocols already see: request/reply round trips
+ * (the hello exchange, then periodic MCP pings), sequence gaps in incoming audio, bytes on the wire and the time
+ * spent in blocking sends. Safe to feed from the network and main tasks at the same time.
+ */
+class LinkQualityEstimator {
+public:
+    void Reset();
+
+    // Smoothed as in RFC 6298
+    void OnRttSample(int rtt_ms);
+    // Cumulative counters of incoming audio packets, e.g. AudioReorderStatistics
+    void OnPacketCounters(uint32_t received, uint32_t lost);
+    void OnBytesSent(size_t bytes);
+    void OnBytesReceived(size_t bytes);
+    void OnSendTime(int send_time_ms);
+
+    LinkQuality Get();
+
+private:
+    std::mutex mutex_;
+    LinkQuality quality_;
+    uint32_t last_received_ = 0;
+    uint32_t last_lost_ = 0;
+    size_t tx_bytes_ = 0;
+    size_t rx_bytes_ = 0;
+    std::chrono::steady_clock::time_point window_start_ = std::chrono::steady_clock::now();
+
+    void UpdateThroughput(std::chrono::steady_clock::time_point now);
+};
+
+#endif // LINK_QUALITY_H
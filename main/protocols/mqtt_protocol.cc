@@ -2,9 +2,14 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
+#include "json_arena.h"
+#include "audio_packet_pool.h"
+#include "udp_audio_header.h"
 
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -12,22 +17,61 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t reorder_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (MqttProtocol*)arg;
+            protocol->reorder_buffer_.ReleaseExpired([protocol](std::unique_ptr<AudioStreamPacket> packet) {
+                protocol->ReleaseIncomingAudio(std::move(packet));
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "udp_reorder",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&reorder_timer_args, &reorder_timer_);
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    if (reorder_timer_ != nullptr) {
+        esp_timer_stop(reorder_timer_);
+        esp_timer_delete(reorder_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
+void MqttProtocol::ReleaseIncomingAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (on_incoming_audio_ != nullptr) {
+        on_incoming_audio_(std::move(packet));
+    }
+}
+
+// The reply is over, play the packets still held behind a lost one now instead of at the start of the next reply
+void MqttProtocol::OnControlMessageReceived(const ControlMessage& message) {
+    if (message.type == kControlMessageTts && message.state == "stop") {
+        reorder_buffer_.Flush([this](std::unique_ptr<AudioStreamPacket> packet) {
+            ReleaseIncomingAudio(std::move(packet));
+        });
+    }
+}
+
 bool MqttProtocol::Start() {
     return StartMqttClient(false);
 }
 
+// Runs at startup and in the channel open task, never twice at once, so it is the only writer of mqtt_
 bool MqttProtocol::StartMqttClient(bool report_error) {
-    if (mqtt_ != nullptr) {
-        ESP_LOGW(TAG, "Mqtt client already started");
-        mqtt_.reset();
+    std::unique_ptr<Mqtt> old_mqtt;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        if (mqtt_ != nullptr) {
+            ESP_LOGW(TAG, "Mqtt client already started");
+            old_mqtt = std::move(mqtt_);
+        }
     }
+    old_mqtt.reset();
 
     Settings settings("mqtt", false);
     auto endpoint = settings.GetString("endpoint");
@@ -35,7 +79,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     auto username = settings.GetString("username");
     auto password = settings.GetString("password");
     int keepalive_interval = settings.GetInt("keepalive", 240);
-    publish_topic_ = settings.GetString("publish_topic");
+    auto publish_topic = settings.GetString("publish_topic");
 
     if (endpoint.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
@@ -46,14 +90,22 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     }
 
     auto network = Board::GetInstance().GetNetwork();
-    mqtt_ = network->CreateMqtt(0);
-    mqtt_->SetKeepAlive(keepalive_interval);
+    auto mqtt = network->CreateMqtt(0);
+    mqtt->SetKeepAlive(keepalive_interval);
 
-    mqtt_->OnDisconnected([this]() {
+    mqtt->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
     });
 
-    mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
+    mqtt->OnMessage([this](const std::string& topic, const std::string& payload) {
+        if (DispatchControlMessage(payload.data(), payload.size())) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            return;
+        }
+
+        // The tree lives in this arena until the handler returns, the goodbye lambda and
+        // the on_incoming_json_ handlers must not capture root or any node of it
+        JsonArena arena(payload.size());
         cJSON* root = cJSON_Parse(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
@@ -72,12 +124,20 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
             if (session_id == nullptr || session_id_ == session_id->valuestring) {
-                Application::GetInstance().Schedule([this]() {
+                // Closing publishes a goodbye of our own, so it runs on the sender task
+                Application::GetInstance().SendControl([this]() {
                     CloseAudioChannel();
                 });
             }
-        } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+        } else {
+            // Same as OnControlMessageReceived, for the messages the fast parser did not take
+            auto state = cJSON_GetObjectItem(root, "state");
+            if (strcmp(type->valuestring, "tts") == 0 && cJSON_IsString(state) && strcmp(state->valuestring, "stop") == 0) {
+                OnControlMessageReceived(ControlMessage{.type = kControlMessageTts, .state = "stop"});
+            }
+            if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
         }
         cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
@@ -93,7 +153,13 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     } else {
         broker_address = endpoint;
     }
-    if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
+    auto client = mqtt.get();
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        publish_topic_ = publish_topic;
+        mqtt_ = std::move(mqtt);
+    }
+    if (!client->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
@@ -104,7 +170,8 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 }
 
 bool MqttProtocol::SendText(const std::string& text) {
-    if (publish_topic_.empty()) {
+    std::lock_guard<std::mutex> lock(mqtt_mutex_);
+    if (mqtt_ == nullptr || publish_topic_.empty()) {
         return false;
     }
     if (!mqtt_->Publish(publish_topic_, text)) {
@@ -121,24 +188,34 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+    // Reuse the datagram buffer, its capacity stays at the largest packet sent so far
+    auto& datagram = udp_send_buffer_;
+    datagram.resize(aes_nonce_.size() + packet->payload.size());
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    // The header doubles as the AES-CTR nonce
+    auto header = (uint8_t*)datagram.data();
+    memcpy(header, aes_nonce_.data(), aes_nonce_.size());
+    *(uint16_t*)&header[2] = htons(packet->payload.size());
+    *(uint32_t*)&header[8] = htonl(packet->timestamp);
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
 
+    // mbedtls advances the counter, so work on a copy to keep the header intact
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, header, sizeof(nonce_counter));
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, nonce_counter, stream_block,
+        packet->payload.data(), header + aes_nonce_.size()) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    auto start_time = std::chrono::steady_clock::now();
+    bool success = udp_->Send(datagram) > 0;
+    auto send_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    link_quality_.OnSendTime(send_time.count());
+    link_quality_.OnBytesSent(datagram.size());
+    return success;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -146,11 +223,17 @@ void MqttProtocol::CloseAudioChannel() {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
     }
+    esp_timer_stop(reorder_timer_);
+
+    auto stats = reorder_buffer_.statistics();
+    ESP_LOGI(TAG, "UDP audio: received %lu, reordered %lu, lost %lu, late %lu, duplicate %lu",
+        stats.received, stats.reordered, stats.lost, stats.late, stats.duplicate);
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
+    std::string message;
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "goodbye")
+    .EndObject();
     SendText(message);
 
     if (on_audio_channel_closed_ != nullptr) {
@@ -159,7 +242,12 @@ void MqttProtocol::CloseAudioChannel() {
 }
 
 bool MqttProtocol::OpenAudioChannel() {
-    if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
+    bool connected;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        connected = mqtt_ != nullptr && mqtt_->IsConnected();
+    }
+    if (!connected) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
             return false;
@@ -170,6 +258,7 @@ bool MqttProtocol::OpenAudioChannel() {
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
+    auto hello_time = std::chrono::steady_clock::now();
     auto message = GetHelloMessage();
     if (!SendText(message)) {
         return false;
@@ -182,53 +271,54 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    OnHelloRoundTrip(hello_time);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
+    int frame_duration = server_frame_duration_ > 0 ? server_frame_duration_ : OPUS_FRAME_DURATION_MS;
+    // Packets arrive out of order by about as much as the delay varies
+    int window_ms = MQTT_UDP_REORDER_WINDOW_MS;
+    auto quality = link_quality_.Get();
+    if (quality.rtt_ms >= 0) {
+        window_ms = std::clamp(2 * quality.rtt_variation_ms, MQTT_UDP_REORDER_MIN_WINDOW_MS, MQTT_UDP_REORDER_WINDOW_MS);
+    }
+    ESP_LOGI(TAG, "UDP reorder window %d ms", window_ms);
+    reorder_buffer_.Reset(std::max(1, window_ms / frame_duration), window_ms);
+    esp_timer_stop(reorder_timer_);
+    esp_timer_start_periodic(reorder_timer_, frame_duration * 1000);
     auto network = Board::GetInstance().GetNetwork();
     udp_ = network->CreateUdp(2);
     udp_->OnMessage([this](const std::string& data) {
-        /*
-         * UDP Encrypted OPUS Packet Format:
-         * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
-         * |payload payload_len|
-         */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
+        link_quality_.OnBytesReceived(data.size());
+        UdpAudioHeader header;
+        if (!ParseUdpAudioHeader(data, header)) {
+            ESP_LOGE(TAG, "Invalid audio packet, size: %u, type: %x", data.size(), data.empty() ? 0 : data[0]);
             return;
         }
-        if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
-            return;
-        }
-        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        // Decrypt straight into the packet payload, the nonce counter is copied because mbedtls advances it
+        size_t decrypted_size = data.size() - UDP_AUDIO_HEADER_SIZE;
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        uint8_t nonce_counter[16];
+        memcpy(nonce_counter, data.data(), sizeof(nonce_counter));
+        auto encrypted = (const uint8_t*)data.data() + UDP_AUDIO_HEADER_SIZE;
+        // Pooled storage, the decoder returns the packet once the frame is played
+        auto packet = AudioPacketPool::GetInstance().Acquire();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
-        packet->timestamp = timestamp;
+        packet->timestamp = header.timestamp;
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce_counter, stream_block, encrypted, packet->payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(packet));
-        }
-        remote_sequence_ = sequence;
+        // Out-of-order packets are held for a short window and released in sequence order
+        reorder_buffer_.Push(header.sequence, std::move(packet), [this](std::unique_ptr<AudioStreamPacket> packet) {
+            ReleaseIncomingAudio(std::move(packet));
+        });
+        auto stats = reorder_buffer_.statistics();
+        link_quality_.OnPacketCounters(stats.received, stats.lost);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -307,7 +397,6 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     mbedtls_aes_init(&aes_ctx_);
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -331,5 +420,6 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     return udp_ != nullptr && !error_occurred_ && !IsTimeout();
 }
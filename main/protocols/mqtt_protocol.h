@@ -3,12 +3,14 @@
 
 
 #include "protocol.h"
+#include "audio_reorder_buffer.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
 #include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
 
 #include <functional>
 #include <string>
@@ -17,6 +19,10 @@
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
+// How long out-of-order UDP audio packets are held before the missing ones are skipped.
+// Sized from the measured delay variation within these bounds, the maximum until there is an estimate
+#define MQTT_UDP_REORDER_WINDOW_MS 180
+#define MQTT_UDP_REORDER_MIN_WINDOW_MS 60
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
@@ -30,23 +36,32 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    AudioReorderStatistics GetAudioReorderStatistics() { return reorder_buffer_.statistics(); }
 
 private:
     EventGroupHandle_t event_group_handle_;
 
+    // Guards mqtt_ and publish_topic_, the open task replaces the client while the sender task publishes
+    std::mutex mqtt_mutex_;
     std::string publish_topic_;
-
-    std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
+
+    // Guards udp_ and the UDP send state
+    mutable std::mutex channel_mutex_;
     std::unique_ptr<Udp> udp_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    AudioReorderBuffer reorder_buffer_;
+    // Releases packets stuck behind a lost one while no new packets arrive
+    esp_timer_handle_t reorder_timer_ = nullptr;
 
     bool StartMqttClient(bool report_error=false);
+    void ReleaseIncomingAudio(std::unique_ptr<AudioStreamPacket> packet);
+    void OnControlMessageReceived(const ControlMessage& message) override;
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
@@ -1,4 +1,6 @@
 #include "protocol.h"
+#include "control_tlv.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 
@@ -8,6 +10,10 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
+void Protocol::OnIncomingControl(std::function<bool(const ControlMessage& message)> callback) {
+    on_incoming_control_ = callback;
+}
+
 void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
     on_incoming_audio_ = callback;
 }
@@ -24,6 +30,24 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+bool Protocol::DispatchControlMessage(const char* data, size_t len) {
+    if (on_incoming_control_ == nullptr) {
+        return false;
+    }
+    ControlMessage message;
+    if (!ParseControlMessage(data, len, message)) {
+        return false;
+    }
+    OnControlMessageReceived(message);
+    return on_incoming_control_(message);
+}
+
+// The hello exchange is the one request/reply pair every server supports, use it as an RTT sample
+void Protocol::OnHelloRoundTrip(std::chrono::steady_clock::time_point hello_time) {
+    auto rtt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hello_time);
+    link_quality_.OnRttSample(rtt.count());
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -31,42 +55,113 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+bool Protocol::SendAudioBundle(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    for (auto& packet : packets) {
+        if (!SendAudio(std::move(packet))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    if (control_tlv_) {
+        std::string payload;
+        ControlTlvWriter writer(payload, kControlTlvAbort);
+        writer.Add(kControlTlvSessionId, session_id_);
+        if (reason == kAbortReasonWakeWordDetected) {
+            writer.Add(kControlTlvReason, "wake_word_detected");
+        }
+        SendControlTlv(payload);
+        return;
+    }
+
+    std::string message;
+    JsonWriter writer(message);
+    writer.Reserve(session_id_.size() + 72).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Field("reason", "wake_word_detected");
     }
-    message += "}";
+    writer.EndObject();
     SendText(message);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    if (control_tlv_) {
+        std::string payload;
+        ControlTlvWriter writer(payload, kControlTlvListen);
+        writer.Add(kControlTlvSessionId, session_id_);
+        writer.Add(kControlTlvState, "detect");
+        writer.Add(kControlTlvText, wake_word);
+        SendControlTlv(payload);
+        return;
+    }
+
+    std::string message;
+    JsonWriter writer(message);
+    writer.Reserve(session_id_.size() + wake_word.size() + 72).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "detect")
+        .Field("text", wake_word)
+    .EndObject();
+    SendText(message);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
-    if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
-    } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
-    } else {
-        message += ",\"mode\":\"manual\"";
+    if (control_tlv_) {
+        std::string payload;
+        ControlTlvWriter writer(payload, kControlTlvListen);
+        writer.Add(kControlTlvSessionId, session_id_);
+        writer.Add(kControlTlvState, "start");
+        writer.Add(kControlTlvMode, mode == kListeningModeRealtime ? "realtime" :
+            (mode == kListeningModeAutoStop ? "auto" : "manual"));
+        SendControlTlv(payload);
+        return;
     }
-    message += "}";
+
+    std::string message;
+    JsonWriter writer(message);
+    writer.Reserve(session_id_.size() + 80).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "start")
+        .Field("mode", mode == kListeningModeRealtime ? "realtime" :
+            (mode == kListeningModeAutoStop ? "auto" : "manual"))
+    .EndObject();
     SendText(message);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
+    if (control_tlv_) {
+        std::string payload;
+        ControlTlvWriter writer(payload, kControlTlvListen);
+        writer.Add(kControlTlvSessionId, session_id_);
+        writer.Add(kControlTlvState, "stop");
+        SendControlTlv(payload);
+        return;
+    }
+
+    std::string message;
+    JsonWriter writer(message);
+    writer.Reserve(session_id_.size() + 56).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "stop")
+    .EndObject();
     SendText(message);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    std::string message;
+    JsonWriter writer(message);
+    writer.Reserve(session_id_.size() + payload.size() + 48).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "mcp")
+        .RawField("payload", payload)
+    .EndObject();
     SendText(message);
 }
 
@@ -6,6 +6,11 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+#include <atomic>
+
+#include "control_message.h"
+#include "link_quality.h"
 
 struct AudioStreamPacket {
     int sample_rate = 0;
@@ -16,7 +21,7 @@ struct AudioStreamPacket {
 
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: OPUS bundle, 3: control TLV)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -30,6 +35,13 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+enum BinaryMessageType {
+    kBinaryTypeOpus = 0,
+    kBinaryTypeJson = 1,
+    kBinaryTypeOpusBundle = 2, // See audio_bundle.h
+    kBinaryTypeControl = 3     // See control_tlv.h
+};
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -54,9 +66,23 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // RTT, loss and throughput as seen by this protocol, safe to read from any task
+    inline LinkQuality GetLinkQuality() {
+        return link_quality_.Get();
+    }
+    // Round trips measured above the protocol, e.g. an MCP ping
+    inline void AddRttSample(int rtt_ms) {
+        link_quality_.OnRttSample(rtt_ms);
+    }
+    // Negotiated with the server, 1 means every packet is sent on its own
+    inline size_t max_audio_bundle_frames() const {
+        return max_audio_bundle_frames_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Hot messages are offered here before being parsed with cJSON, return true if handled
+    void OnIncomingControl(std::function<bool(const ControlMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -66,6 +92,7 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    virtual bool SendAudioBundle(std::vector<std::unique_ptr<AudioStreamPacket>>& packets);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -74,6 +101,7 @@ public:
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<bool(const ControlMessage& message)> on_incoming_control_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
@@ -81,11 +109,22 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    // Written when the server hello arrives, read by the task that sends audio
+    std::atomic<size_t> max_audio_bundle_frames_ = 1;
+    // Negotiated with the server, hot control messages are sent with SendControlTlv.
+    // Set from the server hello, read by whichever task sends a control message
+    std::atomic<bool> control_tlv_ = false;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    LinkQualityEstimator link_quality_;
 
     virtual bool SendText(const std::string& text) = 0;
+    virtual bool SendControlTlv(const std::string& /* payload */) { return false; }
+    bool DispatchControlMessage(const char* data, size_t len);
+    // Sees every hot control message before the application does
+    virtual void OnControlMessageReceived(const ControlMessage& /* message */) {}
+    void OnHelloRoundTrip(std::chrono::steady_clock::time_point hello_time);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
@@ -0,0 +1,37 @@
+#ifndef UDP_AUDIO_HEADER_H
+#define UDP_AUDIO_HEADER_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+/*
+ * UDP Encrypted OPUS Packet Format:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+ * |payload payload_len|
+ *
+ * The 16-byte header doubles as the AES-CTR nonce of the payload.
+ */
+#define UDP_AUDIO_HEADER_SIZE 16
+#define UDP_AUDIO_PACKET_TYPE 0x01
+
+struct UdpAudioHeader {
+    uint32_t timestamp = 0;
+    uint32_t sequence = 0;
+};
+
+// Returns false if the datagram is too short or not an audio packet
+inline bool ParseUdpAudioHeader(const std::string& data, UdpAudioHeader& header) {
+    if (data.size() < UDP_AUDIO_HEADER_SIZE || (uint8_t)data[0] != UDP_AUDIO_PACKET_TYPE) {
+        return false;
+    }
+    uint32_t value;
+    memcpy(&value, &data[8], sizeof(value));
+    header.timestamp = ntohl(value);
+    memcpy(&value, &data[12], sizeof(value));
+    header.sequence = ntohl(value);
+    return true;
+}
+
+#endif // UDP_AUDIO_HEADER_H
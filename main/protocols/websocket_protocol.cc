@@ -3,8 +3,15 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_bundle.h"
+#include "audio_packet_pool.h"
+#include "binary_protocol.h"
+#include "control_tlv.h"
+#include "json_writer.h"
+#include "json_arena.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -14,9 +21,28 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t warm_idle_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            // Ping() and closing the connection are writes, they belong on the sender task
+            Application::GetInstance().SendControl([protocol]() {
+                protocol->OnWarmIdleTimer();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_warm_idle",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&warm_idle_timer_args, &warm_idle_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (warm_idle_timer_ != nullptr) {
+        esp_timer_stop(warm_idle_timer_);
+        esp_timer_delete(warm_idle_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,38 +52,84 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
+    if (version_ != 2 && version_ != 3) {
+        return SendBinary(packet->payload.data(), packet->payload.size());
+    }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+    // The header is written in place at the front of a reused buffer, so framing a packet
+    // costs one payload copy and no allocation once the buffer has grown to the frame size.
+    // The encoder owns the layout of the payload vector, so the header cannot be written
+    // into headroom in front of it, and WebSocket::Send copies the frame again to mask it.
+    auto payload = WriteBinaryHeader(version_, kBinaryTypeOpus, packet->timestamp, packet->payload.size(), send_buffer_);
+    memcpy(payload, packet->payload.data(), packet->payload.size());
+    return SendBinary(send_buffer_.data(), send_buffer_.size());
+}
+
+bool WebsocketProtocol::SendAudioBundle(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    if (packets.size() <= 1 || packets.size() > max_audio_bundle_frames_) {
+        return Protocol::SendAudioBundle(packets);
+    }
+
+    size_t bundle_size = GetAudioBundleSize(packets);
+    std::unique_lock<std::mutex> lock(channel_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    auto payload = (version_ == 2 || version_ == 3) ?
+        WriteBinaryHeader(version_, kBinaryTypeOpusBundle, packets.front()->timestamp, bundle_size, send_buffer_) : nullptr;
+    if (payload == nullptr) {
+        // SendAudio takes the lock for each packet
+        lock.unlock();
+        return Protocol::SendAudioBundle(packets);
     }
+    EncodeAudioBundle(packets, payload);
+    return SendBinary(send_buffer_.data(), send_buffer_.size());
+}
+
+// Called with channel_mutex_ held
+bool WebsocketProtocol::SendBinary(const void* data, size_t len) {
+    auto start_time = std::chrono::steady_clock::now();
+    bool success = websocket_->Send(data, len, true);
+    auto send_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    link_quality_.OnSendTime(send_time.count());
+    link_quality_.OnBytesSent(len);
+    return success;
+}
+
+bool WebsocketProtocol::SendControlTlv(const std::string& payload) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    // Control messages have their own buffer so they never clobber an audio frame being built
+    std::string message;
+    auto tlv = (version_ == 2 || version_ == 3) ?
+        WriteBinaryHeader(version_, kBinaryTypeControl, 0, payload.size(), message) : nullptr;
+    if (tlv == nullptr) {
+        return false;
+    }
+    memcpy(tlv, payload.data(), payload.size());
+
+    if (!SendBinary(message.data(), message.size())) {
+        ESP_LOGE(TAG, "Failed to send control message");
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    return SendTextLocked(text);
+}
+
+bool WebsocketProtocol::SendTextLocked(const std::string& text) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
@@ -67,32 +139,190 @@ bool WebsocketProtocol::SendText(const std::string& text) {
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
+    link_quality_.OnBytesSent(text.size());
 
     return true;
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    return channel_opened_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    std::unique_ptr<WebSocket> websocket;
+    bool keep_connection = false;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        channel_opened_ = false;
+
+#if CONFIG_WEBSOCKET_WARM_IDLE_SECONDS > 0
+        if (server_warm_idle_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+            // End the session but keep the connection, so the next session skips the connect.
+            // Only done when the server hello said it takes a new hello after goodbye
+            std::string message;
+            JsonWriter(message).BeginObject()
+                .Field("session_id", session_id_)
+                .Field("type", "goodbye")
+            .EndObject();
+            if (SendTextLocked(message)) {
+                keep_connection = true;
+                warm_idle_ = true;
+                warm_idle_deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(CONFIG_WEBSOCKET_WARM_IDLE_SECONDS);
+                int interval_ms = std::min(WEBSOCKET_PROTOCOL_PING_INTERVAL_MS, CONFIG_WEBSOCKET_WARM_IDLE_SECONDS * 1000);
+                esp_timer_stop(warm_idle_timer_);
+                esp_timer_start_periodic(warm_idle_timer_, interval_ms * 1000);
+                ESP_LOGI(TAG, "Keeping websocket connection for %d seconds", CONFIG_WEBSOCKET_WARM_IDLE_SECONDS);
+            }
+        }
+#endif
+
+        if (!keep_connection) {
+            warm_idle_ = false;
+            websocket = std::move(websocket_);
+        }
+    }
+
+    if (keep_connection && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+    // Destroyed outside the lock, the websocket task may still be delivering a message
+    websocket.reset();
+}
+
+void WebsocketProtocol::OnWarmIdleTimer() {
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (!warm_idle_) {
+            // OpenAudioChannel has taken the connection
+            esp_timer_stop(warm_idle_timer_);
+            return;
+        }
+
+        if (websocket_ != nullptr && websocket_->IsConnected() && std::chrono::steady_clock::now() < warm_idle_deadline_) {
+            websocket_->Ping();
+            return;
+        }
+
+        ESP_LOGI(TAG, "Closing idle websocket connection");
+        esp_timer_stop(warm_idle_timer_);
+        warm_idle_ = false;
+        websocket = std::move(websocket_);
+    }
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    error_occurred_ = false;
+    max_audio_bundle_frames_ = 1;
+    control_tlv_ = false;
+    server_warm_idle_ = false;
+    auto open_time = std::chrono::steady_clock::now();
+
+    // Take the idle connection under the lock, so a warm idle timer already queued on the
+    // sender task sees warm_idle_ cleared and leaves it alone
+    bool reuse = false;
+    std::unique_ptr<WebSocket> stale;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        esp_timer_stop(warm_idle_timer_);
+        reuse = warm_idle_ && websocket_ != nullptr && websocket_->IsConnected();
+        warm_idle_ = false;
+        if (!reuse) {
+            stale = std::move(websocket_);
+        }
+    }
+
+    if (reuse) {
+        ESP_LOGI(TAG, "Reusing idle websocket connection");
+    } else {
+        // Drop a stale connection before connecting again
+        stale.reset();
+        if (!Connect()) {
+            return false;
+        }
+    }
+
+    if (!ExchangeHello()) {
+        if (error_occurred_) {
+            return false;
+        }
+        if (!reuse) {
+            ESP_LOGE(TAG, "Failed to receive server hello");
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+            return false;
+        }
+        // The server may have dropped the session state of the idle connection without
+        // closing it, start over on a new connection
+        ESP_LOGW(TAG, "No server hello on the idle connection, connecting again");
+        {
+            std::lock_guard<std::mutex> lock(channel_mutex_);
+            stale = std::move(websocket_);
+        }
+        // Still idle as far as OnDisconnected is concerned, closing it must not end this session
+        warm_idle_ = true;
+        stale.reset();
+        warm_idle_ = false;
+        if (!Connect()) {
+            return false;
+        }
+        if (!ExchangeHello()) {
+            if (!error_occurred_) {
+                ESP_LOGE(TAG, "Failed to receive server hello");
+                SetError(Lang::Strings::SERVER_TIMEOUT);
+            }
+            return false;
+        }
+        reuse = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        channel_opened_ = true;
+    }
+    auto open_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - open_time);
+    ESP_LOGI(TAG, "Audio channel opened in %d ms (%s connection)", (int)open_ms.count(), reuse ? "idle" : "new");
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    return true;
+}
+
+// Sends the client hello and waits for the server hello, returns false on a send failure
+// (error_occurred_ is set) or when the server does not answer in time
+bool WebsocketProtocol::ExchangeHello() {
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    auto hello_time = std::chrono::steady_clock::now();
+    auto message = GetHelloMessage();
+    if (!SendText(message)) {
+        return false;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        return false;
+    }
+    OnHelloRoundTrip(hello_time);
+    return true;
+}
+
+bool WebsocketProtocol::Connect() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
     int version = settings.GetInt("version");
-    if (version != 0) {
-        version_ = version;
+    if (version == 0) {
+        version = version_;
     }
 
-    error_occurred_ = false;
+    // A new connection may take a different path, start the estimate over
+    link_quality_.Reset();
 
+    // Built and connected without the lock, senders see no connection until it is ready
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    std::unique_ptr<WebSocket> websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
     }
@@ -102,50 +332,23 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
+        link_quality_.OnBytesReceived(len);
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
-                }
-            }
+            OnBinaryMessage((const uint8_t*)data, len);
+        } else if (DispatchControlMessage(data, len)) {
+            // Handled without building a cJSON tree
         } else {
-            // Parse JSON data
+            // Parse JSON data, the tree and everything the handlers build from it live in one arena.
+            // on_incoming_json_ runs inside this scope: a handler that defers work with Schedule
+            // must copy what it needs out of root, the tree is gone when this block ends
+            JsonArena arena(len);
             auto root = cJSON_Parse(data);
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
@@ -164,38 +367,33 @@ bool WebsocketProtocol::OpenAudioChannel() {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        if (warm_idle_) {
+            // The session has already ended, the next OpenAudioChannel connects again
+            return;
+        }
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
-    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
+    // Every connect is a full TCP + TLS handshake. TLS session resumption is not supported:
+    // esp-tls is configured inside the WebSocket of esp-ml307, which exposes no session
+    // ticket or client session hooks, so only warm idle saves the handshake.
+    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version);
+    auto connect_time = std::chrono::steady_clock::now();
+    if (!websocket->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    auto connect_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - connect_time);
+    ESP_LOGI(TAG, "Websocket connected in %d ms", (int)connect_ms.count());
 
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
-
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
-    }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
-
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    version_ = version;
+    websocket_ = std::move(websocket);
     return true;
 }
 
@@ -209,6 +407,14 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Only the versions with a binary header can mark a message as a bundle
+    if (version_ == 2 || version_ == 3) {
+        cJSON_AddNumberToObject(features, "audio_bundle", AUDIO_BUNDLE_MAX_FRAMES);
+        cJSON_AddBoolToObject(features, "control_tlv", true);
+    }
+#if CONFIG_WEBSOCKET_WARM_IDLE_SECONDS > 0
+    cJSON_AddBoolToObject(features, "warm_idle", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
@@ -249,5 +455,61 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+    auto features = cJSON_GetObjectItem(root, "features");
+#if CONFIG_WEBSOCKET_WARM_IDLE_SECONDS > 0
+    server_warm_idle_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "warm_idle"));
+#endif
+    if (cJSON_IsObject(features) && (version_ == 2 || version_ == 3)) {
+        auto audio_bundle = cJSON_GetObjectItem(features, "audio_bundle");
+        if (cJSON_IsNumber(audio_bundle) && audio_bundle->valueint > 1) {
+            max_audio_bundle_frames_ = std::min(audio_bundle->valueint, AUDIO_BUNDLE_MAX_FRAMES);
+            ESP_LOGI(TAG, "Audio bundle enabled, max frames: %u", max_audio_bundle_frames_.load());
+        }
+        control_tlv_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "control_tlv"));
+    }
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
+
+void WebsocketProtocol::OnBinaryMessage(const uint8_t* data, size_t len) {
+    // Headers are read in place, the payload is copied once straight into a pooled packet
+    BinaryMessage message;
+    if (!ParseBinaryMessage(version_, data, len, message)) {
+        ESP_LOGE(TAG, "Invalid binary message, size: %u", len);
+        return;
+    }
+
+    if (message.type == kBinaryTypeControl) {
+        ControlMessage control;
+        if (!DecodeControlTlv(message.payload, message.payload_size, control) ||
+            on_incoming_control_ == nullptr || !on_incoming_control_(control)) {
+            ESP_LOGW(TAG, "Unhandled control message, size: %u", message.payload_size);
+        }
+        return;
+    }
+
+    if (on_incoming_audio_ == nullptr) {
+        return;
+    }
+
+    auto deliver = [this](uint32_t timestamp, const uint8_t* frame, size_t frame_size) {
+        auto packet = AudioPacketPool::GetInstance().Acquire();
+        packet->sample_rate = server_sample_rate_;
+        packet->frame_duration = server_frame_duration_;
+        packet->timestamp = timestamp;
+        packet->payload.assign(frame, frame + frame_size);
+        on_incoming_audio_(std::move(packet));
+    };
+    if (message.type != kBinaryTypeOpusBundle) {
+        deliver(message.timestamp, message.payload, message.payload_size);
+        return;
+    }
+
+    uint32_t timestamp = message.timestamp;
+    bool valid = DecodeAudioBundle(message.payload, message.payload_size, [this, timestamp, &deliver](int index, const uint8_t* frame, size_t frame_size) {
+        deliver(timestamp == 0 ? 0 : timestamp + index * server_frame_duration_, frame, frame_size);
+    });
+    if (!valid) {
+        ESP_LOGE(TAG, "Invalid audio bundle, size: %u", message.payload_size);
+    }
+}
@@ -7,8 +7,13 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <mutex>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_PING_INTERVAL_MS 20000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -17,17 +22,37 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudioBundle(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Guards websocket_, send_buffer_ and the channel / warm idle state, which are used
+    // from the sender task, the main loop and the channel open task
+    mutable std::mutex channel_mutex_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
-
+    std::string send_buffer_;
+    bool channel_opened_ = false;
+    // After a session ends the connection may be kept open until warm_idle_deadline_.
+    // Also read by the websocket task in OnDisconnected
+    std::atomic<bool> warm_idle_ = false;
+    // Set from the server hello on the websocket task, the server takes a new hello after goodbye
+    std::atomic<bool> server_warm_idle_ = false;
+    std::chrono::steady_clock::time_point warm_idle_deadline_;
+    esp_timer_handle_t warm_idle_timer_ = nullptr;
+
+    bool Connect();
+    bool ExchangeHello();
+    void OnWarmIdleTimer();
     void ParseServerHello(const cJSON* root);
+    void OnBinaryMessage(const uint8_t* data, size_t len);
     bool SendText(const std::string& text) override;
+    bool SendTextLocked(const std::string& text);
+    bool SendControlTlv(const std::string& payload) override;
+    bool SendBinary(const void* data, size_t len);
     std::string GetHelloMessage();
 };
 
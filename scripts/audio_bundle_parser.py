@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+'''
+  Reference parser for the binary audio messages sent by the device over WebSocket
+  (docs/websocket.md, 3.3 and 3.4), for servers that enable the audio_bundle feature.
+
+    python3 audio_bundle_parser.py --self-test
+    python3 audio_bundle_parser.py --version 2 --frame-duration 60 0002000200000000000003e80000000d...
+'''
+import argparse
+import struct
+
+TYPE_OPUS = 0
+TYPE_OPUS_BUNDLE = 2
+
+# 3 frames (01 02), (03), (04 05 06) in a version 2 message with timestamp 1000,
+# the same bytes as GOLDEN_V2 in tests/host/audio_bundle_test.cc
+GOLDEN_V2 = bytes.fromhex(
+    "0002" "0002" "00000000" "000003e8" "0000000d"
+    "03" "0002" "0001" "0003"
+    "0102" "03" "040506"
+)
+
+
+def parse_audio_message(data: bytes, version: int, frame_duration: int):
+    '''Returns [(timestamp, opus_frame), ...], raises ValueError if the message is malformed'''
+    if version == 2:
+        if len(data) < 16:
+            raise ValueError("truncated header")
+        _, msg_type, _, timestamp, size = struct.unpack_from("!HHIII", data)
+        header_size = 16
+    elif version == 3:
+        if len(data) < 4:
+            raise ValueError("truncated header")
+        msg_type, _, size = struct.unpack_from("!BBH", data)
+        timestamp = 0
+        header_size = 4
+    else:
+        return [(0, data)]
+
+    if len(data) < header_size + size:
+        raise ValueError("truncated payload")
+    payload = data[header_size:header_size + size]
+    if msg_type == TYPE_OPUS:
+        return [(timestamp, payload)]
+    if msg_type != TYPE_OPUS_BUNDLE:
+        raise ValueError("not an audio message, type %d" % msg_type)
+
+    if len(payload) < 1 or payload[0] == 0 or len(payload) < 1 + 2 * payload[0]:
+        raise ValueError("invalid audio bundle")
+    count = payload[0]
+    sizes = struct.unpack_from("!%dH" % count, payload, 1)
+    if 1 + 2 * count + sum(sizes) != len(payload):
+        raise ValueError("invalid audio bundle")
+
+    frames, offset = [], 1 + 2 * count
+    for i, frame_size in enumerate(sizes):
+        # Version 3 carries no timestamp, every frame gets 0
+        frame_timestamp = timestamp + i * frame_duration if version == 2 else 0
+        frames.append((frame_timestamp, payload[offset:offset + frame_size]))
+        offset += frame_size
+    return frames
+
+
+def self_test():
+    frames = parse_audio_message(GOLDEN_V2, 2, 60)
+    assert frames == [(1000, b"\x01\x02"), (1060, b"\x03"), (1120, b"\x04\x05\x06")], frames
+
+    v3 = struct.pack("!BBH", TYPE_OPUS_BUNDLE, 0, len(GOLDEN_V2) - 16) + GOLDEN_V2[16:]
+    assert [frame for _, frame in parse_audio_message(v3, 3, 60)] == [b"\x01\x02", b"\x03", b"\x04\x05\x06"]
+
+    for length in range(len(GOLDEN_V2)):
+        try:
+            parse_audio_message(GOLDEN_V2[:length], 2, 60)
+        except ValueError:
+            continue
+        raise AssertionError("accepted a message truncated to %d bytes" % length)
+    print("audio bundle parser self test passed")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Parse a binary audio message from the device")
+    parser.add_argument("--self-test", action="store_true", help="check the parser against the golden vector")
+    parser.add_argument("--version", type=int, default=2, help="binary protocol version")
+    parser.add_argument("--frame-duration", type=int, default=60, help="frame duration in milliseconds")
+    parser.add_argument("message", nargs="?", help="the message in hex")
+    args = parser.parse_args()
+
+    if args.self_test:
+        self_test()
+        return
+    if not args.message:
+        parser.error("message is required")
+    for timestamp, frame in parse_audio_message(bytes.fromhex(args.message), args.version, args.frame_duration):
+        print(timestamp, frame.hex())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,137 @@
+#include "test_harness.h"
+#include "audio_bundle.h"
+#include "binary_protocol.h"
+
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+static std::vector<std::unique_ptr<AudioStreamPacket>> MakePackets(const std::vector<std::vector<uint8_t>>& frames) {
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    for (auto& frame : frames) {
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->payload = frame;
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+static std::string EncodeMessage(int version, uint32_t timestamp, const std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    std::string message;
+    auto payload = WriteBinaryHeader(version, kBinaryTypeOpusBundle, timestamp, GetAudioBundleSize(packets), message);
+    EncodeAudioBundle(packets, payload);
+    return message;
+}
+
+// Same bytes as GOLDEN_V2 in scripts/audio_bundle_parser.py, keep them in sync
+static const uint8_t GOLDEN_V2[] = {
+    0x00, 0x02, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x03, 0xe8, 0x00, 0x00, 0x00, 0x0d,
+    0x03, 0x00, 0x02, 0x00, 0x01, 0x00, 0x03,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+};
+
+TEST_CASE(MatchesGoldenVector) {
+    auto packets = MakePackets({{0x01, 0x02}, {0x03}, {0x04, 0x05, 0x06}});
+    auto message = EncodeMessage(2, 1000, packets);
+    CHECK_EQ(message.size(), sizeof(GOLDEN_V2));
+    CHECK(memcmp(message.data(), GOLDEN_V2, sizeof(GOLDEN_V2)) == 0);
+}
+
+TEST_CASE(RoundTrip) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (int i = 0; i < AUDIO_BUNDLE_MAX_FRAMES; i++) {
+        frames.emplace_back(40 + i * 17, (uint8_t)i);
+    }
+    auto packets = MakePackets(frames);
+    auto message = EncodeMessage(3, 0, packets);
+
+    BinaryMessage parsed;
+    CHECK(ParseBinaryMessage(3, (const uint8_t*)message.data(), message.size(), parsed));
+    CHECK_EQ(parsed.type, (int)kBinaryTypeOpusBundle);
+    std::vector<std::vector<uint8_t>> decoded;
+    CHECK(DecodeAudioBundle(parsed.payload, parsed.payload_size, [&](int index, const uint8_t* frame, size_t frame_size) {
+        CHECK_EQ(index, (int)decoded.size());
+        decoded.emplace_back(frame, frame + frame_size);
+    }));
+    CHECK(decoded == frames);
+}
+
+TEST_CASE(RejectsMalformedBundles) {
+    auto packets = MakePackets({{0x01, 0x02}, {0x03}, {0x04, 0x05, 0x06}});
+    std::vector<uint8_t> bundle(GetAudioBundleSize(packets));
+    EncodeAudioBundle(packets, bundle.data());
+    int calls = 0;
+    auto on_frame = [&](int, const uint8_t*, size_t) { calls++; };
+
+    for (size_t len = 0; len < bundle.size(); len++) {
+        CHECK(!DecodeAudioBundle(bundle.data(), len, on_frame));
+    }
+    bundle.push_back(0);
+    CHECK(!DecodeAudioBundle(bundle.data(), bundle.size(), on_frame));
+    bundle.pop_back();
+    bundle[0] = 0;
+    CHECK(!DecodeAudioBundle(bundle.data(), bundle.size(), on_frame));
+    CHECK_EQ(calls, 0);
+}
+
+// Per-message overhead below the binary protocol header, for a frame of the given size:
+// the masked client WebSocket header, a TLS 1.2 AES-GCM record and the TCP/IPv4 headers
+// of each 1460 byte segment. Queued frames sent one by one usually leave in separate
+// segments because each Send() is a separate write; a bundle is one write.
+static size_t TransportOverhead(size_t message_size) {
+    size_t websocket = 2 + 4 + (message_size > 125 ? 2 : 0);
+    size_t tls = 5 + 8 + 16;
+    size_t segments = (message_size + websocket + tls + 1459) / 1460;
+    return websocket + tls + segments * (20 + 20);
+}
+
+#define BENCH_ITERATIONS 20000
+
+TEST_CASE(BytesOnTheWire) {
+    // 60 ms Opus frames at 16 kHz are 40 to 200 bytes depending on the content
+    const size_t frame_sizes[] = {40, 120, 200};
+    for (int version = 2; version <= 3; version++) {
+        for (size_t frame_size : frame_sizes) {
+            for (size_t count = 2; count <= AUDIO_BUNDLE_MAX_FRAMES; count *= 2) {
+                auto packets = MakePackets(std::vector<std::vector<uint8_t>>(count, std::vector<uint8_t>(frame_size, 0x5a)));
+
+                size_t separate = 0;
+                for (auto& packet : packets) {
+                    std::string message;
+                    WriteBinaryHeader(version, kBinaryTypeOpus, 0, packet->payload.size(), message);
+                    separate += message.size() + TransportOverhead(message.size());
+                }
+                auto bundle = EncodeMessage(version, 0, packets);
+                size_t bundled = bundle.size() + TransportOverhead(bundle.size());
+
+                std::printf("v%d %zu x %3zu bytes: %5zu bytes separate, %5zu bundled (%.0f%% less)\n",
+                    version, count, frame_size, separate, bundled, 100.0 * (separate - bundled) / separate);
+                CHECK(bundled < separate);
+            }
+        }
+    }
+}
+
+TEST_CASE(EncodeDecodeBenchmark) {
+    auto packets = MakePackets(std::vector<std::vector<uint8_t>>(AUDIO_BUNDLE_MAX_FRAMES, std::vector<uint8_t>(120, 0x5a)));
+    std::string message;
+    size_t frames = 0;
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        auto payload = WriteBinaryHeader(3, kBinaryTypeOpusBundle, 0, GetAudioBundleSize(packets), message);
+        EncodeAudioBundle(packets, payload);
+        BinaryMessage parsed;
+        ParseBinaryMessage(3, (const uint8_t*)message.data(), message.size(), parsed);
+        DecodeAudioBundle(parsed.payload, parsed.payload_size, [&](int, const uint8_t*, size_t) { frames++; });
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    std::printf("encode + decode of %d x 120 byte bundles: %.0f bundles/s\n", AUDIO_BUNDLE_MAX_FRAMES, BENCH_ITERATIONS / seconds);
+    CHECK_EQ(frames, (size_t)BENCH_ITERATIONS * AUDIO_BUNDLE_MAX_FRAMES);
+}
+
+TEST_MAIN()
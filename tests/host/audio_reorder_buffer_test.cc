@@ -0,0 +1,178 @@
+#include "test_harness.h"
+#include "audio_reorder_buffer.h"
+#include "udp_audio_header.h"
+
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define FRAME_MS 60
+#define WINDOW_MS 180
+
+// One captured datagram: when it arrived and the sequence number in its header
+struct TraceEvent {
+    int arrival_ms;
+    uint32_t sequence;
+};
+
+static std::string MakeDatagram(uint32_t sequence) {
+    std::string datagram(UDP_AUDIO_HEADER_SIZE + 1, '\0');
+    datagram[0] = UDP_AUDIO_PACKET_TYPE;
+    uint32_t timestamp = htonl(sequence * FRAME_MS);
+    uint32_t network_sequence = htonl(sequence);
+    memcpy(&datagram[8], &timestamp, sizeof(timestamp));
+    memcpy(&datagram[12], &network_sequence, sizeof(network_sequence));
+    datagram[UDP_AUDIO_HEADER_SIZE] = (char)sequence;
+    return datagram;
+}
+
+// Replays the trace the way MqttProtocol receives it: parse the header, push into the
+// buffer, and run ReleaseExpired on every frame tick like the udp_reorder timer
+static std::vector<uint32_t> Replay(AudioReorderBuffer& buffer, const std::vector<TraceEvent>& trace,
+        size_t window_packets = WINDOW_MS / FRAME_MS) {
+    std::vector<uint32_t> released;
+    auto release = [&](std::unique_ptr<AudioStreamPacket> packet) {
+        released.push_back(packet->timestamp / FRAME_MS);
+        CHECK_EQ((uint8_t)packet->payload[0], (uint8_t)(packet->timestamp / FRAME_MS));
+    };
+    host_timer_set_time(0);
+    buffer.Reset(window_packets, WINDOW_MS);
+    int now_ms = 0;
+    for (auto& event : trace) {
+        while (now_ms + FRAME_MS <= event.arrival_ms) {
+            now_ms += FRAME_MS;
+            host_timer_set_time(now_ms * 1000LL);
+            buffer.ReleaseExpired(release);
+        }
+        host_timer_set_time(event.arrival_ms * 1000LL);
+        auto datagram = MakeDatagram(event.sequence);
+        UdpAudioHeader header;
+        CHECK(ParseUdpAudioHeader(datagram, header));
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->timestamp = header.timestamp;
+        packet->payload.assign(datagram.begin() + UDP_AUDIO_HEADER_SIZE, datagram.end());
+        buffer.Push(header.sequence, std::move(packet), release);
+    }
+    buffer.Flush(release);
+    return released;
+}
+
+TEST_CASE(ParserRejectsShortAndForeignDatagrams) {
+    UdpAudioHeader header;
+    CHECK(!ParseUdpAudioHeader(std::string(UDP_AUDIO_HEADER_SIZE - 1, '\x01'), header));
+    auto datagram = MakeDatagram(7);
+    datagram[0] = 0x02;
+    CHECK(!ParseUdpAudioHeader(datagram, header));
+    CHECK(ParseUdpAudioHeader(MakeDatagram(0x01020304), header));
+    CHECK_EQ(header.sequence, 0x01020304u);
+}
+
+TEST_CASE(InOrder) {
+    AudioReorderBuffer buffer;
+    auto released = Replay(buffer, {{0, 100}, {60, 101}, {120, 102}, {180, 103}});
+    CHECK_EQ(released, (std::vector<uint32_t>{100, 101, 102, 103}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.received, 4u);
+    CHECK_EQ(stats.reordered, 0u);
+    CHECK_EQ(stats.lost, 0u);
+}
+
+TEST_CASE(Reordered) {
+    AudioReorderBuffer buffer;
+    auto released = Replay(buffer, {{0, 0}, {60, 1}, {120, 3}, {125, 2}, {180, 5}, {200, 4}, {240, 6}});
+    CHECK_EQ(released, (std::vector<uint32_t>{0, 1, 2, 3, 4, 5, 6}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.reordered, 2u);
+    CHECK_EQ(stats.lost, 0u);
+    CHECK_EQ(stats.released, 7u);
+}
+
+TEST_CASE(Duplicated) {
+    AudioReorderBuffer buffer;
+    // 1 is duplicated right away, 3 while it waits for 2, 2 again after it was released
+    auto released = Replay(buffer, {{0, 0}, {60, 1}, {61, 1}, {120, 3}, {121, 3}, {130, 2}, {180, 2}, {240, 4}});
+    CHECK_EQ(released, (std::vector<uint32_t>{0, 1, 2, 3, 4}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.duplicate, 3u);
+    CHECK_EQ(stats.late, 0u);
+}
+
+TEST_CASE(LostPacketTimesOut) {
+    AudioReorderBuffer buffer;
+    std::vector<uint32_t> released;
+    // 2 never arrives, 3 and 4 are released once 3 has waited for the whole window
+    released = Replay(buffer, {{0, 0}, {60, 1}, {180, 3}, {240, 4}, {1000, 5}});
+    CHECK_EQ(released, (std::vector<uint32_t>{0, 1, 3, 4, 5}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.lost, 1u);
+    CHECK_EQ(stats.late, 0u);
+}
+
+TEST_CASE(LateAfterSkip) {
+    AudioReorderBuffer buffer;
+    auto released = Replay(buffer, {{0, 0}, {60, 1}, {180, 3}, {240, 4}, {500, 2}, {540, 5}});
+    CHECK_EQ(released, (std::vector<uint32_t>{0, 1, 3, 4, 5}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.lost, 1u);
+    CHECK_EQ(stats.late, 1u);
+}
+
+TEST_CASE(WindowFull) {
+    AudioReorderBuffer buffer;
+    // A burst arrives while 1 is missing, the fourth waiting packet gives up on it
+    auto released = Replay(buffer, {{0, 0}, {60, 2}, {61, 3}, {62, 4}, {63, 5}, {64, 1}}, 3);
+    CHECK_EQ(released, (std::vector<uint32_t>{0, 2, 3, 4, 5}));
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.lost, 1u);
+    CHECK_EQ(stats.late, 1u);
+}
+
+// The network task pushes while the timer task releases expired packets. Packets must
+// come out in order, and the callback may look at the statistics without deadlocking.
+TEST_CASE(ConcurrentReleaseKeepsOrder) {
+    AudioReorderBuffer buffer;
+    host_timer_set_time(0);
+    buffer.Reset(4, WINDOW_MS);
+    std::vector<uint32_t> released;
+    std::atomic<bool> in_callback = false;
+    auto release = [&](std::unique_ptr<AudioStreamPacket> packet) {
+        CHECK(!in_callback.exchange(true));
+        released.push_back(packet->timestamp);
+        buffer.statistics();
+        in_callback = false;
+    };
+    std::atomic<bool> done = false;
+    std::thread timer([&]() {
+        while (!done) {
+            host_timer_advance(FRAME_MS * 1000);
+            buffer.ReleaseExpired(release);
+        }
+    });
+    for (uint32_t i = 0; i < 20000; i++) {
+        // Every tenth packet swaps with the next one, every 97th is lost
+        uint32_t sequence = i % 10 == 0 ? i + 1 : (i % 10 == 1 ? i - 1 : i);
+        if (sequence % 97 == 0) {
+            continue;
+        }
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->timestamp = sequence;
+        buffer.Push(sequence, std::move(packet), release);
+    }
+    done = true;
+    timer.join();
+    buffer.Flush(release);
+
+    bool increasing = true;
+    for (size_t i = 1; i < released.size(); i++) {
+        increasing = increasing && released[i] > released[i - 1];
+    }
+    CHECK(increasing);
+    auto stats = buffer.statistics();
+    CHECK_EQ(stats.released, released.size());
+    CHECK_EQ(stats.received, stats.released + stats.late + stats.duplicate);
+}
+
+TEST_MAIN()
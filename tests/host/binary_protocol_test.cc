@@ -0,0 +1,173 @@
+#include "test_harness.h"
+#include "binary_protocol.h"
+#include "audio_bundle.h"
+#include "audio_packet_pool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<size_t> g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+TEST_CASE(RoundTripEveryVersion) {
+    const uint8_t opus[] = {1, 2, 3, 4, 5};
+    for (int version = 1; version <= 3; version++) {
+        std::string frame;
+        auto payload = WriteBinaryHeader(version, kBinaryTypeOpus, 1234, sizeof(opus), frame);
+        CHECK(payload != nullptr);
+        memcpy(payload, opus, sizeof(opus));
+
+        BinaryMessage message;
+        CHECK(ParseBinaryMessage(version, (const uint8_t*)frame.data(), frame.size(), message));
+        CHECK_EQ(message.type, (int)kBinaryTypeOpus);
+        CHECK_EQ(message.timestamp, version == 2 ? 1234u : 0u);
+        CHECK_EQ(message.payload_size, sizeof(opus));
+        CHECK(memcmp(message.payload, opus, sizeof(opus)) == 0);
+    }
+}
+
+TEST_CASE(RejectsTruncatedMessages) {
+    for (int version = 2; version <= 3; version++) {
+        std::string frame;
+        WriteBinaryHeader(version, kBinaryTypeOpus, 0, 100, frame);
+        BinaryMessage message;
+        for (size_t len = 0; len < frame.size(); len++) {
+            CHECK(!ParseBinaryMessage(version, (const uint8_t*)frame.data(), len, message));
+        }
+        CHECK(ParseBinaryMessage(version, (const uint8_t*)frame.data(), frame.size(), message));
+    }
+}
+
+TEST_CASE(HeaderLimits) {
+    std::string frame;
+    CHECK(WriteBinaryHeader(3, kBinaryTypeOpusBundle, 0, UINT16_MAX + 1, frame) == nullptr);
+    CHECK(WriteBinaryHeader(1, kBinaryTypeControl, 0, 10, frame) == nullptr);
+    CHECK(WriteBinaryHeader(2, kBinaryTypeControl, 0, UINT16_MAX + 1, frame) != nullptr);
+}
+
+// Stand-in for the WebSocket client on a loopback connection: like esp_websocket_client
+// it copies every frame into its own buffer to mask it, then hands the unmasked
+// message to the receive handler as an echo server would send it back
+class EchoWebSocket {
+public:
+    size_t transport_bytes_copied = 0;
+
+    template<typename Handler>
+    void Send(const void* data, size_t len, const Handler& on_data) {
+        uint8_t header[8] = {0x82, 0xfe, (uint8_t)(len >> 8), (uint8_t)len, 0x12, 0x34, 0x56, 0x78};
+        tx_buffer_.resize(sizeof(header) + len);
+        memcpy(tx_buffer_.data(), header, sizeof(header));
+        auto source = (const uint8_t*)data;
+        for (size_t i = 0; i < len; i++) {
+            tx_buffer_[sizeof(header) + i] = source[i] ^ header[4 + i % 4];
+        }
+        rx_buffer_.resize(len);
+        for (size_t i = 0; i < len; i++) {
+            rx_buffer_[i] = tx_buffer_[sizeof(header) + i] ^ header[4 + i % 4];
+        }
+        transport_bytes_copied += 2 * len;
+        on_data(rx_buffer_.data(), rx_buffer_.size());
+    }
+
+private:
+    std::vector<uint8_t> tx_buffer_;
+    std::vector<uint8_t> rx_buffer_;
+};
+
+#define FRAMES 200000
+#define OPUS_FRAME_SIZE 180
+
+struct FramingResult {
+    double frames_per_second;
+    double protocol_bytes_copied;
+    double transport_bytes_copied;
+    double allocations;
+};
+
+// pooled: the current WebsocketProtocol path, a reused send buffer and pooled receive packets.
+// Otherwise a new string per sent frame and a new packet per received frame, as before.
+static FramingResult RunFraming(int version, bool pooled) {
+    EchoWebSocket websocket;
+    std::string send_buffer;
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->payload.assign(OPUS_FRAME_SIZE, 0x5a);
+    size_t protocol_bytes_copied = 0;
+    size_t received = 0;
+
+    auto on_data = [&](const uint8_t* data, size_t len) {
+        BinaryMessage message;
+        if (!ParseBinaryMessage(version, data, len, message)) {
+            return;
+        }
+        auto incoming = pooled ? AudioPacketPool::GetInstance().Acquire() : std::make_unique<AudioStreamPacket>();
+        incoming->timestamp = message.timestamp;
+        incoming->payload.assign(message.payload, message.payload + message.payload_size);
+        protocol_bytes_copied += message.payload_size;
+        received++;
+        if (pooled) {
+            AudioPacketPool::GetInstance().Release(std::move(incoming));
+        }
+    };
+
+    size_t allocations = 0;
+    timespec start;
+    for (int i = 0; i < FRAMES; i++) {
+        if (i == 100) {
+            allocations = g_allocations;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+        packet->timestamp = i * 60;
+        std::string unpooled_buffer;
+        auto& buffer = pooled ? send_buffer : unpooled_buffer;
+        auto payload = WriteBinaryHeader(version, kBinaryTypeOpus, packet->timestamp, packet->payload.size(), buffer);
+        memcpy(payload, packet->payload.data(), packet->payload.size());
+        protocol_bytes_copied += buffer.size();
+        websocket.Send(buffer.data(), buffer.size(), on_data);
+    }
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CHECK_EQ(received, (size_t)FRAMES);
+
+    size_t measured = FRAMES - 100;
+    FramingResult result;
+    result.frames_per_second = measured / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    result.protocol_bytes_copied = (double)protocol_bytes_copied / FRAMES;
+    result.transport_bytes_copied = (double)websocket.transport_bytes_copied / FRAMES;
+    result.allocations = (double)(g_allocations - allocations) / measured;
+    return result;
+}
+
+TEST_CASE(FramingBenchmark) {
+    for (int version = 2; version <= 3; version++) {
+        auto before = RunFraming(version, false);
+        auto after = RunFraming(version, true);
+        std::printf("v%d allocating: %.0f frames/s, %.0f bytes copied/frame (+%.0f in the WebSocket client), %.2f allocations/frame\n",
+            version, before.frames_per_second, before.protocol_bytes_copied, before.transport_bytes_copied, before.allocations);
+        std::printf("v%d pooled:     %.0f frames/s, %.0f bytes copied/frame (+%.0f in the WebSocket client), %.2f allocations/frame\n",
+            version, after.frames_per_second, after.protocol_bytes_copied, after.transport_bytes_copied, after.allocations);
+        CHECK(after.allocations < 0.01);
+        CHECK(before.allocations >= 3.0);
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,136 @@
+#include "test_harness.h"
+#include "control_message.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+static bool Parse(const std::string& json, ControlMessage& message) {
+    return ParseControlMessage(json.data(), json.size(), message);
+}
+
+TEST_CASE(HotMessages) {
+    ControlMessage message;
+    CHECK(Parse(R"({"session_id":"abc","type":"tts","state":"sentence_start","text":"你好"})", message));
+    CHECK_EQ(message.type, kControlMessageTts);
+    CHECK(message.state == "sentence_start");
+    CHECK(message.text == "你好");
+    CHECK(message.emotion.data() == nullptr);
+
+    CHECK(Parse(" { \"type\" : \"llm\" , \"emotion\" : \"happy\" , \"extra\" : {\"a\":[1,\"}\"]} }\n", message));
+    CHECK_EQ(message.type, kControlMessageLlm);
+    CHECK(message.emotion == "happy");
+
+    std::string terminated = R"({"type":"stt","text":"hi"})";
+    CHECK(ParseControlMessage(terminated.c_str(), terminated.size() + 1, message));
+    CHECK_EQ(message.type, kControlMessageStt);
+}
+
+TEST_CASE(FallsBackToCJson) {
+    ControlMessage message;
+    CHECK(!Parse(R"({"type":"hello","transport":"websocket"})", message));
+    CHECK(!Parse(R"({"type":"tts","text":"line\nbreak"})", message));
+    CHECK(!Parse(R"({"type":"tts","state":"stop"} x)", message));
+    CHECK(!Parse(R"({"type":"tts",})", message));
+    CHECK(!Parse("", message));
+}
+
+// The string ends in a backslash right at the end of the data, the scanner must not step past it
+TEST_CASE(TrailingBackslash) {
+    ControlMessage message;
+    const char prefixes[][32] = {"{\"type\":\"tts\",\"text\":\"a\\", "{\"type\":\"tts\",\"x\":[\"\\", "{\"\\"};
+    for (auto prefix : prefixes) {
+        size_t len = strlen(prefix);
+        // Exactly sized heap copy, so a sanitizer build catches a read past the end
+        std::unique_ptr<char[]> data(new char[len]);
+        memcpy(data.get(), prefix, len);
+        CHECK(!ParseControlMessage(data.get(), len, message));
+    }
+}
+
+TEST_CASE(EveryTruncationIsRejected) {
+    std::string json = R"({"type":"tts","state":"sentence_start","text":"a\"b","extra":[{"k":"\\"}]})";
+    ControlMessage message;
+    for (size_t len = 0; len < json.size(); len++) {
+        std::unique_ptr<char[]> data(new char[len + 1]);
+        memcpy(data.get(), json.data(), len);
+        CHECK(!ParseControlMessage(data.get(), len, message));
+    }
+}
+
+#ifdef HAVE_CJSON
+
+static size_t g_cjson_allocations = 0;
+
+static void* CountingMalloc(size_t size) {
+    g_cjson_allocations++;
+    return std::malloc(size);
+}
+
+#define BENCH_ITERATIONS 200000
+
+static double Seconds(const timespec& start, const timespec& end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// What the application did for every tts message before: build a tree and look up the fields
+static bool ParseWithCJson(const std::string& json, ControlMessage& message) {
+    auto root = cJSON_ParseWithLength(json.data(), json.size());
+    if (root == nullptr) {
+        return false;
+    }
+    auto type = cJSON_GetObjectItem(root, "type");
+    auto state = cJSON_GetObjectItem(root, "state");
+    auto text = cJSON_GetObjectItem(root, "text");
+    message.type = cJSON_IsString(type) && strcmp(type->valuestring, "tts") == 0 ? kControlMessageTts : kControlMessageUnknown;
+    message.state = cJSON_IsString(state) ? state->valuestring : "";
+    message.text = cJSON_IsString(text) ? text->valuestring : "";
+    cJSON_Delete(root);
+    return true;
+}
+
+TEST_CASE(BenchmarkAgainstCJson) {
+    cJSON_Hooks hooks = {CountingMalloc, std::free};
+    cJSON_InitHooks(&hooks);
+
+    const std::string messages[] = {
+        R"({"session_id":"6f1c2a","type":"tts","state":"sentence_start","text":"今天天气不错，适合出去走走。"})",
+        R"({"session_id":"6f1c2a","type":"tts","state":"stop"})",
+        R"({"session_id":"6f1c2a","type":"llm","text":"😊","emotion":"happy"})",
+    };
+    for (auto& json : messages) {
+        ControlMessage message;
+        timespec start, middle, end;
+        size_t fast_ok = 0, cjson_ok = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            fast_ok += Parse(json, message);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &middle);
+        g_cjson_allocations = 0;
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            cjson_ok += ParseWithCJson(json, message);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double fast_ns = Seconds(start, middle) * 1e9 / BENCH_ITERATIONS;
+        double cjson_ns = Seconds(middle, end) * 1e9 / BENCH_ITERATIONS;
+        std::printf("%3zu bytes: scanner %6.0f ns, cJSON %6.0f ns (%.1fx), cJSON allocations %.1f\n",
+            json.size(), fast_ns, cjson_ns, cjson_ns / fast_ns, (double)g_cjson_allocations / BENCH_ITERATIONS);
+        CHECK_EQ(fast_ok, (size_t)BENCH_ITERATIONS);
+        CHECK_EQ(cjson_ok, (size_t)BENCH_ITERATIONS);
+    }
+
+    cJSON_InitHooks(nullptr);
+}
+
+#endif // HAVE_CJSON
+
+TEST_MAIN()
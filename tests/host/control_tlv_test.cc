@@ -0,0 +1,158 @@
+#include "test_harness.h"
+#include "control_tlv.h"
+#include "protocol.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool Decode(const std::string& payload, ControlMessage& message) {
+    return DecodeControlTlv((const uint8_t*)payload.data(), payload.size(), message);
+}
+
+TEST_CASE(RoundTrip) {
+    const struct {
+        ControlTlvType type;
+        ControlMessageType expected;
+    } types[] = {
+        {kControlTlvTts, kControlMessageTts},
+        {kControlTlvStt, kControlMessageStt},
+        {kControlTlvLlm, kControlMessageLlm},
+    };
+    for (auto& item : types) {
+        std::string payload;
+        ControlTlvWriter writer(payload, item.type);
+        writer.Add(kControlTlvSessionId, "6f1c2a");
+        writer.Add(kControlTlvState, "sentence_start");
+        writer.Add(kControlTlvText, "今天天气不错\n\"quoted\"");
+        writer.Add(kControlTlvEmotion, "happy");
+
+        ControlMessage message;
+        CHECK(Decode(payload, message));
+        CHECK_EQ(message.type, item.expected);
+        CHECK(message.state == "sentence_start");
+        CHECK(message.text == "今天天气不错\n\"quoted\"");
+        CHECK(message.emotion == "happy");
+    }
+}
+
+// Lengths around the LEB128 byte boundaries
+TEST_CASE(LongValues) {
+    const size_t lengths[] = {0, 1, 127, 128, 300, 16383, 16384, 70000};
+    for (size_t length : lengths) {
+        std::string text(length, 'x');
+        std::string payload;
+        ControlTlvWriter writer(payload, kControlTlvTts);
+        writer.Add(kControlTlvText, text);
+        size_t length_bytes = length < 128 ? 1 : (length < 16384 ? 2 : 3);
+        CHECK_EQ(payload.size(), 2 + length_bytes + length);
+
+        ControlMessage message;
+        CHECK(Decode(payload, message));
+        CHECK_EQ(message.text.size(), length);
+        CHECK(message.state.data() == nullptr);
+    }
+}
+
+TEST_CASE(UnknownTagsAreSkipped) {
+    std::string payload;
+    ControlTlvWriter writer(payload, kControlTlvLlm);
+    writer.Add((ControlTlvTag)0x7f, "future field");
+    writer.Add(kControlTlvEmotion, "sad");
+    ControlMessage message;
+    CHECK(Decode(payload, message));
+    CHECK(message.emotion == "sad");
+}
+
+TEST_CASE(RejectsMalformedMessages) {
+    std::string payload;
+    ControlTlvWriter writer(payload, kControlTlvTts);
+    writer.Add(kControlTlvState, "stop");
+    writer.Add(kControlTlvText, std::string(200, 'y'));
+
+    ControlMessage message;
+    for (size_t len = 0; len < payload.size(); len++) {
+        // Cutting right after a complete field leaves a valid shorter message
+        if (len == 1 || len == 7) {
+            continue;
+        }
+        CHECK(!DecodeControlTlv((const uint8_t*)payload.data(), len, message));
+    }
+    CHECK(!Decode(std::string("\x01\x02\x01" "a", 4), message));
+    // A length that never terminates, and one larger than the message
+    CHECK(!Decode(std::string("\x03\x04\xff\xff\xff\xff\xff\x01", 8), message));
+    CHECK(!Decode(std::string("\x03\x04\x80\x80\x80\x80\x01", 7), message));
+}
+
+// Captures what the shared Protocol send functions put on the wire
+class RecordingProtocol : public Protocol {
+public:
+    std::string text;
+    std::string tlv;
+
+    void Negotiate(bool control_tlv, const std::string& session_id) {
+        control_tlv_ = control_tlv;
+        session_id_ = session_id;
+    }
+
+    bool Start() override { return true; }
+    bool OpenAudioChannel() override { return true; }
+    void CloseAudioChannel() override {}
+    bool IsAudioChannelOpened() const override { return true; }
+    bool SendAudio(std::unique_ptr<AudioStreamPacket>) override { return true; }
+
+protected:
+    bool SendText(const std::string& message) override {
+        text = message;
+        return true;
+    }
+    bool SendControlTlv(const std::string& payload) override {
+        tlv = payload;
+        return true;
+    }
+};
+
+TEST_CASE(SizeComparedToJson) {
+    const struct {
+        const char* name;
+        std::function<void(Protocol&)> send;
+    } messages[] = {
+        {"listen start", [](Protocol& protocol) { protocol.SendStartListening(kListeningModeAutoStop); }},
+        {"listen stop", [](Protocol& protocol) { protocol.SendStopListening(); }},
+        {"listen detect", [](Protocol& protocol) { protocol.SendWakeWordDetected("你好小智"); }},
+        {"abort", [](Protocol& protocol) { protocol.SendAbortSpeaking(kAbortReasonWakeWordDetected); }},
+    };
+    const char* session_ids[] = {"", "c5f1a7e2-3b4d-4e6f-8a9b-0c1d2e3f4a5b"};
+
+    size_t json_total = 0, tlv_total = 0;
+    for (auto session_id : session_ids) {
+        for (auto& item : messages) {
+            RecordingProtocol json, tlv;
+            json.Negotiate(false, session_id);
+            tlv.Negotiate(true, session_id);
+            item.send(json);
+            item.send(tlv);
+            CHECK(!json.text.empty() && json.tlv.empty());
+            CHECK(!tlv.tlv.empty() && tlv.text.empty());
+
+            // A v3 binary frame adds a 4 byte header to the TLV payload, a text frame adds nothing
+            size_t tlv_size = tlv.tlv.size() + 4;
+            std::printf("%-13s session %2zu bytes: JSON %3zu bytes, TLV %3zu bytes (%.0f%%)\n", item.name,
+                strlen(session_id), json.text.size(), tlv_size, 100.0 * tlv_size / json.text.size());
+            CHECK(tlv_size < json.text.size());
+            json_total += json.text.size();
+            tlv_total += tlv_size;
+        }
+    }
+    std::printf("total: JSON %zu bytes, TLV %zu bytes\n", json_total, tlv_total);
+}
+
+// The example in docs/websocket.md 3.5
+TEST_CASE(DocumentedExample) {
+    RecordingProtocol protocol;
+    protocol.Negotiate(true, "");
+    protocol.SendStartListening(kListeningModeAutoStop);
+    CHECK(protocol.tlv == std::string("\x01\x01\x00\x02\x05start\x03\x04" "auto", 16));
+}
+
+TEST_MAIN()
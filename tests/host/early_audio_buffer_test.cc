@@ -0,0 +1,127 @@
+#include "test_harness.h"
+#include "early_audio_buffer.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t timestamp) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->timestamp = timestamp;
+    return packet;
+}
+
+TEST_CASE(FlushPlaysInOrder) {
+    EarlyAudioBuffer buffer(10);
+    buffer.Start("s1");
+    for (uint32_t i = 0; i < 5; i++) {
+        auto packet = MakePacket(i);
+        CHECK(buffer.Offer(packet));
+        CHECK(packet == nullptr);
+    }
+    std::vector<uint32_t> played;
+    buffer.Flush(true, "s1", [&](std::unique_ptr<AudioStreamPacket> packet) {
+        played.push_back(packet->timestamp);
+        return true;
+    });
+    CHECK_EQ(played, (std::vector<uint32_t>{0, 1, 2, 3, 4}));
+    CHECK_EQ(buffer.saved_count(), 5u);
+
+    // Not buffering any more, the caller keeps the packet
+    auto packet = MakePacket(5);
+    CHECK(!buffer.Offer(packet));
+    CHECK(packet != nullptr);
+}
+
+TEST_CASE(OtherSessionOrNoPlayDiscards) {
+    EarlyAudioBuffer buffer(10);
+    int pushed = 0;
+    auto push = [&](std::unique_ptr<AudioStreamPacket>) {
+        pushed++;
+        return true;
+    };
+    buffer.Start("s1");
+    auto packet = MakePacket(0);
+    buffer.Offer(packet);
+    buffer.Flush(true, "s2", push);
+    buffer.Start("s2");
+    packet = MakePacket(1);
+    buffer.Offer(packet);
+    buffer.Flush(false, "s2", push);
+    CHECK_EQ(pushed, 0);
+    CHECK_EQ(buffer.dropped_count(), 2u);
+}
+
+TEST_CASE(OverflowDropsNewest) {
+    EarlyAudioBuffer buffer(3);
+    buffer.Start("s1");
+    for (uint32_t i = 0; i < 5; i++) {
+        auto packet = MakePacket(i);
+        CHECK(buffer.Offer(packet));
+    }
+    std::vector<uint32_t> played;
+    buffer.Flush(true, "s1", [&](std::unique_ptr<AudioStreamPacket> packet) {
+        played.push_back(packet->timestamp);
+        return true;
+    });
+    CHECK_EQ(played, (std::vector<uint32_t>{0, 1, 2}));
+    CHECK_EQ(buffer.dropped_count(), 2u);
+}
+
+// The network task delivers "tts start" and the audio that follows it, while the main loop
+// enters the Speaking state at some point in between. Every packet must reach the decode
+// queue exactly once and in order, whether it was buffered or arrived after the flush.
+TEST_CASE(RacingJsonAndAudio) {
+    for (int round = 0; round < 200; round++) {
+        EarlyAudioBuffer buffer(1000);
+        std::mutex decode_mutex;
+        std::vector<uint32_t> decoded;
+        auto push = [&](std::unique_ptr<AudioStreamPacket> packet) {
+            std::lock_guard<std::mutex> lock(decode_mutex);
+            decoded.push_back(packet->timestamp);
+            return true;
+        };
+        std::atomic<bool> speaking = false;
+        std::atomic<bool> started = false;
+
+        std::thread network([&]() {
+            buffer.Start("s1");
+            started = true;
+            for (uint32_t i = 0; i < 200; i++) {
+                auto packet = MakePacket(i);
+                // Application::OnIncomingAudio
+                if (!buffer.Offer(packet) && speaking) {
+                    push(std::move(packet));
+                }
+                if (i % 16 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        std::thread main_loop([&]() {
+            while (!started) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < round % 50; i++) {
+                std::this_thread::yield();
+            }
+            speaking = true;
+            buffer.Flush(true, "s1", push);
+        });
+        network.join();
+        main_loop.join();
+
+        bool in_order = decoded.size() == 200;
+        for (size_t i = 0; in_order && i < decoded.size(); i++) {
+            in_order = decoded[i] == i;
+        }
+        if (!in_order) {
+            std::printf("round %d: %zu packets decoded out of order or lost\n", round, decoded.size());
+            HostTestFailures()++;
+            return;
+        }
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,61 @@
+#include "test_harness.h"
+#include "endpointer.h"
+
+#define FRAME_MS 60
+
+// Feeds a VAD pattern, one character per frame ('v' voice, '.' silence), and returns
+// the index of the frame that ended the utterance, or -1
+static int Run(Endpointer& endpointer, const char* pattern) {
+    int end_frame = -1;
+    for (int i = 0; pattern[i] != '\0'; i++) {
+        if (endpointer.Feed(pattern[i] == 'v', FRAME_MS)) {
+            CHECK_EQ(end_frame, -1);
+            end_frame = i;
+        }
+    }
+    return end_frame;
+}
+
+TEST_CASE(LeadingSilenceNeverTriggers) {
+    Endpointer endpointer;
+    endpointer.Configure(300, 15000);
+    CHECK_EQ(Run(endpointer, "...................................."), -1);
+    CHECK(!endpointer.triggered());
+    CHECK_EQ(endpointer.utterance_ms(), 0);
+}
+
+TEST_CASE(TrailingSilenceTriggersOnce) {
+    Endpointer endpointer;
+    endpointer.Configure(300, 15000);
+    // 300 ms is five frames of silence after the last voice frame
+    CHECK_EQ(Run(endpointer, "...vvvv....."), 11);
+    CHECK(endpointer.triggered());
+    CHECK_EQ(endpointer.utterance_ms(), 9 * FRAME_MS);
+    // Later frames are ignored until Reset
+    CHECK_EQ(Run(endpointer, "vvvv........"), -1);
+}
+
+TEST_CASE(ShortPausesDoNotTrigger) {
+    Endpointer endpointer;
+    endpointer.Configure(300, 15000);
+    CHECK_EQ(Run(endpointer, "vv....vv....vvv....v"), -1);
+    CHECK(!endpointer.triggered());
+}
+
+TEST_CASE(MaxUtteranceTriggers) {
+    Endpointer endpointer;
+    endpointer.Configure(300, 10 * FRAME_MS);
+    CHECK_EQ(Run(endpointer, "..vvvvvvvvvvvvvvvvvvv"), 11);
+    CHECK_EQ(endpointer.utterance_ms(), 10 * FRAME_MS);
+}
+
+TEST_CASE(ResetStartsOver) {
+    Endpointer endpointer;
+    endpointer.Configure(120, 15000);
+    CHECK_EQ(Run(endpointer, "vv.."), 3);
+    endpointer.Reset();
+    CHECK(!endpointer.triggered());
+    CHECK_EQ(Run(endpointer, "..v.."), 4);
+}
+
+TEST_MAIN()
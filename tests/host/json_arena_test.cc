@@ -0,0 +1,254 @@
+#include "test_harness.h"
+#include "json_arena.h"
+
+#include <cJSON.h>
+#include <csignal>
+#include <esp_heap_caps.h>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Internal SRAM left for the application heap on an ESP32-S3 with Wi-Fi running
+#define HEAP_MODEL_BYTES (160 * 1024)
+// multi_heap keeps a small header with every block and rounds sizes up
+#define HEAP_MODEL_OVERHEAD 8
+#define HEAP_MODEL_ALIGNMENT 8
+
+// An address-ordered first fit heap, fed with every block the heap_caps shim hands out,
+// so the free space left between long-lived blocks can be measured
+class FirstFitHeap {
+public:
+    FirstFitHeap() { free_[0] = HEAP_MODEL_BYTES; }
+
+    void Allocate(const void* ptr, size_t size) {
+        size = (size + HEAP_MODEL_OVERHEAD + HEAP_MODEL_ALIGNMENT - 1) & ~(size_t)(HEAP_MODEL_ALIGNMENT - 1);
+        for (auto it = free_.begin(); it != free_.end(); ++it) {
+            if (it->second >= size) {
+                size_t offset = it->first;
+                size_t remaining = it->second - size;
+                free_.erase(it);
+                if (remaining > 0) {
+                    free_[offset + size] = remaining;
+                }
+                blocks_[ptr] = {offset, size};
+                return;
+            }
+        }
+        failures_++;
+    }
+
+    void Free(const void* ptr) {
+        auto block = blocks_.find(ptr);
+        if (block == blocks_.end()) {
+            return;
+        }
+        auto it = free_.emplace(block->second.first, block->second.second).first;
+        blocks_.erase(block);
+        // Merge with the neighbours
+        auto next = std::next(it);
+        if (next != free_.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            free_.erase(next);
+        }
+        if (it != free_.begin()) {
+            auto previous = std::prev(it);
+            if (previous->first + previous->second == it->first) {
+                previous->second += it->second;
+                free_.erase(it);
+            }
+        }
+    }
+
+    size_t free_bytes() const {
+        size_t total = 0;
+        for (auto& segment : free_) {
+            total += segment.second;
+        }
+        return total;
+    }
+
+    size_t largest_free_block() const {
+        size_t largest = 0;
+        for (auto& segment : free_) {
+            largest = std::max(largest, segment.second);
+        }
+        return largest;
+    }
+
+    size_t holes() const { return free_.size(); }
+    size_t failures() const { return failures_; }
+
+private:
+    std::map<size_t, size_t> free_;
+    std::unordered_map<const void*, std::pair<size_t, size_t>> blocks_;
+    size_t failures_ = 0;
+};
+
+static FirstFitHeap* g_model = nullptr;
+
+static void ObserveHeap(const void* ptr, size_t size) {
+    if (size > 0) {
+        g_model->Allocate(ptr, size);
+    } else {
+        g_model->Free(ptr);
+    }
+}
+
+// What cJSON does on the device without the arena hooks: every node and string is a heap block
+static void* HeapMalloc(size_t size) {
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+// A tools/call request, a few hundred bytes
+static std::string MakeToolCall(int id) {
+    return "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(id) + ",\"method\":\"tools/call\",\"params\":"
+        "{\"name\":\"self.audio_speaker.set_volume\",\"arguments\":{\"volume\":" + std::to_string(id % 100) + "}}}";
+}
+
+// A search response like the ones BochaSearch parses, about 10 KB
+static std::string MakeSearchResponse() {
+    std::string json = "{\"code\":200,\"data\":{\"webPages\":{\"totalEstimatedMatches\":1000,\"value\":[";
+    for (int i = 0; i < 10; i++) {
+        json += std::string(i > 0 ? "," : "") + "{\"id\":\"" + std::to_string(i) + "\",\"name\":\"秋季通勤穿搭推荐 " +
+            std::to_string(i) + "\",\"url\":\"https://example.com/outfit/" + std::to_string(i) +
+            "\",\"snippet\":\"" + std::string(600, 'x') + "\",\"siteName\":\"example\",\"datePublished\":\"2025-09-0" +
+            std::to_string(i % 9 + 1) + "\",\"tags\":[\"通勤\",\"秋季\",\"针织\"]}";
+    }
+    return json + "]}}}";
+}
+
+struct ParseRun {
+    double allocations_per_message;
+    size_t peak_bytes;
+    size_t holes;
+    size_t largest_free_block;
+    double fragmentation;
+    size_t model_failures;
+};
+
+#define MESSAGES 2000
+#define LONG_LIVED_SLOTS 24
+
+// Parses a mix of small and large messages. While each tree is alive the handler makes one
+// allocation that outlives it, like a closure passed to Schedule or a queued audio packet,
+// and the oldest of those is released once LONG_LIVED_SLOTS are held.
+static ParseRun RunParses(bool use_arena) {
+    FirstFitHeap model;
+    g_model = &model;
+    host_heap_set_observer(ObserveHeap);
+    host_heap_reset_stats();
+    if (use_arena) {
+        JsonArena::InstallHooks();
+    } else {
+        cJSON_Hooks hooks = {HeapMalloc, heap_caps_free};
+        cJSON_InitHooks(&hooks);
+    }
+
+    auto search_response = MakeSearchResponse();
+    std::mt19937 random(49);
+    std::vector<void*> long_lived;
+    for (int i = 0; i < MESSAGES; i++) {
+        auto message = i % 10 == 9 ? search_response : MakeToolCall(i);
+        {
+            std::unique_ptr<JsonArena> arena;
+            if (use_arena) {
+                arena = std::make_unique<JsonArena>(message.size());
+            }
+            cJSON* root = cJSON_Parse(message.c_str());
+            CHECK(root != nullptr);
+            long_lived.push_back(heap_caps_malloc(32 + random() % 480, MALLOC_CAP_8BIT));
+            cJSON_Delete(root);
+        }
+        if (long_lived.size() > LONG_LIVED_SLOTS) {
+            heap_caps_free(long_lived.front());
+            long_lived.erase(long_lived.begin());
+        }
+    }
+
+    auto stats = host_heap_stats();
+    ParseRun run;
+    // The long-lived blocks are not part of the parse
+    run.allocations_per_message = (double)(stats.allocations - MESSAGES) / MESSAGES;
+    run.peak_bytes = stats.peak_bytes;
+    run.holes = model.holes();
+    run.largest_free_block = model.largest_free_block();
+    run.fragmentation = 1.0 - (double)model.largest_free_block() / model.free_bytes();
+    run.model_failures = model.failures();
+
+    for (auto block : long_lived) {
+        heap_caps_free(block);
+    }
+    host_heap_set_observer(nullptr);
+    g_model = nullptr;
+    cJSON_InitHooks(nullptr);
+    return run;
+}
+
+TEST_CASE(AllocationsAndFragmentation) {
+    auto heap = RunParses(false);
+    auto arena = RunParses(true);
+    const char* names[] = {"malloc", "arena"};
+    const ParseRun* runs[] = {&heap, &arena};
+    for (int i = 0; i < 2; i++) {
+        auto run = runs[i];
+        std::printf("%-6s: %7.1f heap allocations/message, peak %6zu bytes, %2zu free holes, "
+            "largest free block %6zu bytes (fragmentation %.1f%%)\n", names[i], run->allocations_per_message,
+            run->peak_bytes, run->holes, run->largest_free_block, 100.0 * run->fragmentation);
+        CHECK_EQ(run->model_failures, (size_t)0);
+    }
+    CHECK(arena.allocations_per_message * 10 < heap.allocations_per_message);
+    CHECK(arena.holes <= heap.holes);
+    CHECK(arena.largest_free_block >= heap.largest_free_block);
+}
+
+TEST_CASE(NestedArenasOnOneThread) {
+    JsonArena::InstallHooks();
+    host_heap_reset_stats();
+    {
+        JsonArena outer(64);
+        cJSON* outer_root = cJSON_Parse("{\"type\":\"mcp\",\"payload\":{\"id\":1}}");
+        {
+            JsonArena inner(64);
+            cJSON* inner_root = cJSON_Parse("{\"status\":\"success\"}");
+            // Blocks of the outer arena freed while the inner one is open are still ignored
+            cJSON_Delete(outer_root);
+            cJSON_Delete(inner_root);
+        }
+        auto root = cJSON_CreateObject();
+        cJSON_Delete(root);
+    }
+    auto stats = host_heap_stats();
+    CHECK_EQ(stats.allocations, stats.frees);
+    CHECK_EQ(stats.bytes_in_use, (size_t)0);
+
+    // Without an arena the hooks fall back to malloc and free
+    auto root = cJSON_Parse("[1,2,3]");
+    CHECK(root != nullptr);
+    cJSON_Delete(root);
+    cJSON_InitHooks(nullptr);
+}
+
+#ifndef NDEBUG
+// A tree handed to another thread and freed there is caught before free() sees an arena block
+TEST_CASE(FreeOnAnotherThreadAsserts) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        JsonArena::InstallHooks();
+        JsonArena arena(64);
+        cJSON* root = cJSON_Parse("{\"type\":\"tts\",\"state\":\"stop\"}");
+        std::thread([root]() { cJSON_Delete(root); }).join();
+        _exit(0);
+    }
+    int status = 0;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+#endif
+
+TEST_MAIN()
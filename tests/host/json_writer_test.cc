@@ -0,0 +1,108 @@
+#include "test_harness.h"
+#include "json_writer.h"
+
+#include <random>
+#include <string>
+
+// Decodes a JSON string literal produced by AppendEscaped, returns false on anything
+// that is not valid JSON: raw control characters, unknown escapes, a missing quote
+static bool Unescape(const std::string& literal, std::string& value) {
+    if (literal.size() < 2 || literal.front() != '"' || literal.back() != '"') {
+        return false;
+    }
+    value.clear();
+    for (size_t i = 1; i + 1 < literal.size(); i++) {
+        unsigned char c = literal[i];
+        if (c < 0x20 || c == '"') {
+            return false;
+        }
+        if (c != '\\') {
+            value += (char)c;
+            continue;
+        }
+        if (++i + 1 >= literal.size()) {
+            return false;
+        }
+        switch (literal[i]) {
+        case '"': value += '"'; break;
+        case '\\': value += '\\'; break;
+        case '/': value += '/'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'u': {
+            if (i + 4 >= literal.size() - 1 || literal.compare(i + 1, 2, "00") != 0) {
+                return false;
+            }
+            value += (char)std::stoi(literal.substr(i + 3, 2), nullptr, 16);
+            i += 4;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE(EscapesEveryControlCharacter) {
+    for (int c = 0; c < 0x20; c++) {
+        std::string output;
+        JsonWriter::AppendEscaped(output, std::string(1, (char)c));
+        std::string value;
+        CHECK(Unescape(output, value));
+        CHECK_EQ(value, std::string(1, (char)c));
+    }
+}
+
+TEST_CASE(EscapingRoundTripsRandomStrings) {
+    // Weighted towards the characters that need escaping, plus UTF-8 lead and continuation bytes
+    static const char kSpecial[] = {'"', '\\', '\n', '\r', '\t', '\b', '\f', '\0', '\x01', '\x1f', '/', '\x7f',
+        '\xe4', '\xb8', '\xad'};
+    std::mt19937 random(2024);
+    for (int round = 0; round < 20000; round++) {
+        std::string input(random() % 48, '\0');
+        for (auto& c : input) {
+            c = random() % 3 == 0 ? kSpecial[random() % sizeof(kSpecial)] : (char)(random() % 256);
+        }
+        std::string output = "prefix";
+        JsonWriter::AppendEscaped(output, input);
+        CHECK_EQ(output.compare(0, 6, "prefix"), 0);
+        std::string value;
+        if (!Unescape(output.substr(6), value) || value != input) {
+            std::printf("round %d: escaping does not round trip\n", round);
+            HostTestFailures()++;
+            return;
+        }
+    }
+}
+
+TEST_CASE(InsertsCommas) {
+    std::string output;
+    JsonWriter writer(output);
+    writer.BeginObject()
+        .Field("type", "listen")
+        .Field("count", 3)
+        .Field("ok", true)
+        .Key("list").BeginArray().Int(-1).Int(0).String("a").BeginObject().EndObject().EndArray()
+        .RawField("raw", "{\"x\":1}")
+        .EndObject();
+    CHECK_EQ(output, std::string("{\"type\":\"listen\",\"count\":3,\"ok\":true,\"list\":[-1,0,\"a\",{}],\"raw\":{\"x\":1}}"));
+}
+
+TEST_CASE(NullCStringIsNull) {
+    std::string output;
+    const char* missing = nullptr;
+    JsonWriter(output).BeginObject().Field("text", missing).Field("emotion", "happy").EndObject();
+    CHECK_EQ(output, std::string("{\"text\":null,\"emotion\":\"happy\"}"));
+}
+
+TEST_CASE(IntLimits) {
+    std::string output;
+    JsonWriter(output).BeginArray().Int(INT64_MIN).Int(INT64_MAX).EndArray();
+    CHECK_EQ(output, std::string("[-9223372036854775808,9223372036854775807]"));
+}
+
+TEST_MAIN()
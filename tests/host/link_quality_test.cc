@@ -0,0 +1,86 @@
+#include "test_harness.h"
+#include "link_quality.h"
+
+#include <cstdlib>
+#include <random>
+
+TEST_CASE(FirstRttSampleInitializes) {
+    LinkQualityEstimator estimator;
+    CHECK_EQ(estimator.Get().rtt_ms, -1);
+    estimator.OnRttSample(200);
+    auto quality = estimator.Get();
+    CHECK_EQ(quality.rtt_ms, 200);
+    CHECK_EQ(quality.rtt_variation_ms, 100);
+}
+
+TEST_CASE(RttConvergesToNewLevel) {
+    LinkQualityEstimator estimator;
+    estimator.OnRttSample(400);
+    // The link gets faster, the smoothed RTT reaches the new level within a few dozen samples
+    int samples = 0;
+    while (estimator.Get().rtt_ms > 110 && samples < 100) {
+        estimator.OnRttSample(100);
+        samples++;
+    }
+    CHECK(samples <= 40);
+    CHECK(estimator.Get().rtt_ms <= 110);
+    for (int i = 0; i < 40; i++) {
+        estimator.OnRttSample(100);
+    }
+    CHECK(estimator.Get().rtt_variation_ms <= 5);
+}
+
+TEST_CASE(RttTracksJitter) {
+    LinkQualityEstimator estimator;
+    std::mt19937 random(7);
+    // 150 ms +/- 50 ms, uniformly distributed
+    for (int i = 0; i < 500; i++) {
+        estimator.OnRttSample(100 + random() % 101);
+    }
+    auto quality = estimator.Get();
+    CHECK(std::abs(quality.rtt_ms - 150) <= 25);
+    CHECK(quality.rtt_variation_ms >= 10 && quality.rtt_variation_ms <= 50);
+}
+
+TEST_CASE(LossConvergesToBlockRate) {
+    LinkQualityEstimator estimator;
+    uint32_t received = 0;
+    uint32_t lost = 0;
+    // 10% loss, reported every 10 packets like the reorder buffer statistics
+    for (int i = 0; i < 200; i++) {
+        received += 9;
+        lost += 1;
+        estimator.OnPacketCounters(received, lost);
+    }
+    float loss_rate = estimator.Get().loss_rate;
+    CHECK(loss_rate > 0.09f && loss_rate < 0.11f);
+
+    // Counters restart with a new channel, the estimate keeps converging instead of jumping
+    estimator.OnPacketCounters(50, 0);
+    for (int i = 0; i < 40; i++) {
+        estimator.OnPacketCounters(50 * (i + 2), 0);
+    }
+    CHECK(estimator.Get().loss_rate < 0.01f);
+}
+
+TEST_CASE(SmallBlocksAreAccumulated) {
+    LinkQualityEstimator estimator;
+    // Fewer than a block of packets does not move the estimate
+    estimator.OnPacketCounters(20, 20);
+    CHECK_EQ(estimator.Get().loss_rate, 0.0f);
+    estimator.OnPacketCounters(30, 20);
+    CHECK(estimator.Get().loss_rate > 0.0f);
+}
+
+TEST_CASE(SendTimeSmoothed) {
+    LinkQualityEstimator estimator;
+    for (int i = 0; i < 60; i++) {
+        estimator.OnSendTime(40);
+    }
+    CHECK(estimator.Get().send_time_ms >= 30 && estimator.Get().send_time_ms <= 40);
+    estimator.Reset();
+    CHECK_EQ(estimator.Get().send_time_ms, 0);
+    CHECK_EQ(estimator.Get().rtt_ms, -1);
+}
+
+TEST_MAIN()
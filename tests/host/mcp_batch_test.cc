@@ -0,0 +1,95 @@
+#include "test_harness.h"
+#include "mcp_batch.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sends are the round trips a batch costs, all replies of a batch go out in one message
+struct Sender {
+    std::vector<std::string> messages;
+    std::function<void(std::string)> callback() {
+        return [this](std::string payload) { messages.push_back(std::move(payload)); };
+    }
+};
+
+static size_t CountReplies(const std::string& array) {
+    size_t count = 0;
+    int depth = 0;
+    for (char c : array) {
+        if (c == '{' && ++depth == 1) {
+            count++;
+        } else if (c == '}') {
+            depth--;
+        }
+    }
+    return count;
+}
+
+TEST_CASE(SynchronousRepliesSentOnce) {
+    Sender sender;
+    auto batch = std::make_shared<McpBatch>(sender.callback());
+    batch->Add("{\"id\":1}");
+    batch->Add("{\"id\":2}");
+    CHECK(sender.messages.empty());
+    batch->Complete("");
+    CHECK_EQ(sender.messages.size(), 1u);
+    CHECK_EQ(sender.messages[0], std::string("[{\"id\":1},{\"id\":2}]"));
+}
+
+TEST_CASE(NotificationsOnlySendNothing) {
+    Sender sender;
+    auto batch = std::make_shared<McpBatch>(sender.callback());
+    batch->Expect();
+    batch->Complete("");
+    batch->Complete("");
+    CHECK(sender.messages.empty());
+}
+
+TEST_CASE(RejectedCallStillCompletes) {
+    Sender sender;
+    auto batch = std::make_shared<McpBatch>(sender.callback());
+    batch->Expect();
+    // The worker queue was full, the call is answered with an error inside the batch
+    batch->Complete("{\"id\":3,\"error\":{}}");
+    batch->Add("{\"id\":4}");
+    batch->Complete("");
+    CHECK_EQ(sender.messages.size(), 1u);
+    CHECK_EQ(CountReplies(sender.messages[0]), 2u);
+}
+
+// Parsing adds the synchronous replies and registers the tool calls, the workers finish
+// them in any order, before or after parsing ends
+TEST_CASE(MixedBatchFromWorkers) {
+    for (int round = 0; round < 200; round++) {
+        Sender sender;
+        auto batch = std::make_shared<McpBatch>(sender.callback());
+        std::vector<std::thread> workers;
+        for (int i = 0; i < 8; i++) {
+            if (i % 3 == 0) {
+                batch->Add("{\"id\":" + std::to_string(i) + "}");
+                continue;
+            }
+            batch->Expect();
+            workers.emplace_back([batch, i, round]() {
+                if ((i + round) % 4 == 0) {
+                    std::this_thread::yield();
+                }
+                batch->Complete("{\"id\":" + std::to_string(i) + ",\"result\":{}}");
+            });
+        }
+        batch->Complete("");
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (sender.messages.size() != 1 || CountReplies(sender.messages[0]) != 8) {
+            std::printf("round %d: %zu messages sent\n", round, sender.messages.size());
+            HostTestFailures()++;
+            return;
+        }
+        CHECK(sender.messages[0].front() == '[' && sender.messages[0].back() == ']');
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,158 @@
+#include "test_harness.h"
+#include "mcp_typed_tool.h"
+#include "json_writer.h"
+
+#include <cJSON.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct LightArgs {
+    int brightness;
+    bool on;
+    std::string color;
+};
+
+static std::unique_ptr<McpTool> MakeLightTool() {
+    return std::unique_ptr<McpTool>(MakeMcpTool<LightArgs>("self.light.set", "Set the light",
+        [](const LightArgs& args) -> ReturnValue {
+            return args.color + ":" + std::to_string(args.brightness) + ":" + (args.on ? "on" : "off");
+        },
+        McpArg("brightness", &LightArgs::brightness).Range(0, 100),
+        McpArg("on", &LightArgs::on).Default(true),
+        McpArg("color", &LightArgs::color).Default("white")));
+}
+
+// Binds the arguments and returns the validation error, or the tool result if there is none
+static std::string Bind(McpTool& tool, const char* arguments_json, bool strict = true) {
+    cJSON* arguments = arguments_json != nullptr ? cJSON_Parse(arguments_json) : nullptr;
+    std::string result;
+    try {
+        auto arguments_bound = tool.BindArguments(arguments, strict);
+        result = tool.Call(*arguments_bound);
+    } catch (const std::invalid_argument& e) {
+        result = std::string("error: ") + e.what();
+    }
+    cJSON_Delete(arguments);
+    return result;
+}
+
+static bool Contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+TEST_CASE(ValidArgumentsBindToStruct) {
+    auto tool = MakeLightTool();
+    CHECK(Contains(Bind(*tool, "{\"brightness\":40,\"on\":false,\"color\":\"red\"}"), "red:40:off"));
+    CHECK(Contains(Bind(*tool, "{\"brightness\":0}"), "white:0:on"));
+    CHECK(Contains(Bind(*tool, "{\"brightness\":100,\"color\":null}"), "white:100:on"));
+}
+
+TEST_CASE(ValidationErrors) {
+    auto tool = MakeLightTool();
+    CHECK_EQ(Bind(*tool, "{}"), std::string("error: Missing valid argument: brightness"));
+    CHECK_EQ(Bind(*tool, nullptr), std::string("error: Missing valid argument: brightness"));
+    CHECK_EQ(Bind(*tool, "[1,2]"), std::string("error: Missing valid argument: brightness"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":\"50\"}"), std::string("error: Invalid argument: brightness must be an integer"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":12.5}"), std::string("error: Invalid argument: brightness must be an integer"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":1e12}"), std::string("error: Invalid argument: brightness must be an integer"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":101}"), std::string("error: Invalid argument: brightness must be between 0 and 100"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":-1}"), std::string("error: Invalid argument: brightness must be between 0 and 100"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":5,\"on\":1}"), std::string("error: Invalid argument: on must be a boolean"));
+    CHECK_EQ(Bind(*tool, "{\"brightness\":5,\"color\":7}"), std::string("error: Invalid argument: color must be a string"));
+}
+
+TEST_CASE(LocalCallsAreNotStrict) {
+    auto tool = MakeLightTool();
+    CHECK(Contains(Bind(*tool, "{}", false), "white:0:on"));
+    // Wrong types are still rejected
+    CHECK_EQ(Bind(*tool, "{\"on\":\"yes\"}", false), std::string("error: Invalid argument: on must be a boolean"));
+}
+
+TEST_CASE(DefaultOutsideRangeRejected) {
+    bool thrown = false;
+    try {
+        McpArg("brightness", &LightArgs::brightness).Range(0, 100).Default(200);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+TEST_CASE(SchemaMatchesPropertyListTools) {
+    auto typed = MakeLightTool();
+    McpTool property_list("self.light.set", "Set the light", PropertyList({
+        Property("brightness", kPropertyTypeInteger, 0, 100),
+        Property("on", kPropertyTypeBoolean, true),
+        Property("color", kPropertyTypeString, std::string("white")),
+    }), [](const PropertyList&) -> ReturnValue { return true; });
+    CHECK_EQ(typed->to_json(), property_list.to_json());
+}
+
+// A key only holds a view of the name, building one from a temporary string must not compile
+static_assert(!std::is_constructible_v<McpToolKey, std::string&&>);
+static_assert(std::is_constructible_v<McpToolKey, const std::string&>);
+
+TEST_CASE(ToolKeyHash) {
+    static constexpr McpToolKey literal("self.light.set");
+    std::string name = "self.light.set";
+    McpToolKey key(name);
+    CHECK(key.name() == literal.name());
+    CHECK_EQ(key.hash(), literal.hash());
+    CHECK_EQ(McpToolNameHash(std::string_view(name).substr(0, 14)), literal.hash());
+}
+
+static std::string WritePage(const std::vector<McpTool*>& tools, size_t start, size_t end) {
+    std::string page;
+    JsonWriter writer(page);
+    WriteMcpToolsPage(writer, tools, start, end, "0123abcd");
+    return page;
+}
+
+// Long tool names make the nextCursor trailer longer than a fixed allowance, every page
+// must still fit and its precomputed length must be the length actually written
+TEST_CASE(ToolsPagesFitWithLongNames) {
+    std::vector<std::unique_ptr<McpTool>> owned;
+    std::vector<McpTool*> tools;
+    for (int i = 0; i < 24; i++) {
+        std::string name = "self.\"device\"." + std::string(60 + i * 7, 'a' + i % 26);
+        owned.push_back(std::make_unique<McpTool>(name, "Tool " + std::to_string(i), PropertyList(),
+            [](const PropertyList&) -> ReturnValue { return true; }));
+        tools.push_back(owned.back().get());
+    }
+
+    const size_t max_lengths[] = {800, 1000, 2000, 4000};
+    for (size_t max_length : max_lengths) {
+        size_t start = 0, pages = 0;
+        while (start < tools.size()) {
+            size_t end = GetMcpToolsPageEnd(tools, start, max_length);
+            CHECK(end > start);
+            if (end == start) {
+                break;
+            }
+            auto page = WritePage(tools, start, end);
+            CHECK_EQ(page.size(), GetMcpToolsPageLength(tools, start, end));
+            CHECK(page.size() <= max_length);
+            // One more tool would not have fit
+            if (end < tools.size()) {
+                CHECK(GetMcpToolsPageLength(tools, start, end + 1) > max_length);
+            }
+
+            cJSON* root = cJSON_Parse(page.c_str());
+            CHECK(root != nullptr);
+            CHECK_EQ(cJSON_GetArraySize(cJSON_GetObjectItem(root, "tools")), (int)(end - start));
+            auto next_cursor = cJSON_GetObjectItem(root, "nextCursor");
+            if (end < tools.size()) {
+                CHECK(cJSON_IsString(next_cursor) && next_cursor->valuestring == tools[end]->name() + "@0123abcd");
+            } else {
+                CHECK(next_cursor == nullptr);
+            }
+            cJSON_Delete(root);
+            start = end;
+            pages++;
+        }
+        std::printf("max %4zu bytes: %zu pages\n", max_length, pages);
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,99 @@
+#include "test_harness.h"
+#include "memory_policy.h"
+
+#include <esp_heap_caps.h>
+#include <random>
+#include <vector>
+
+// Internal SRAM left for the heap shim, enough to leave the low level with its margin
+#define HEAP_BUDGET_BYTES (64 * 1024)
+
+static void FreeAll(std::vector<void*>& blocks) {
+    for (auto block : blocks) {
+        heap_caps_free(block);
+    }
+    blocks.clear();
+}
+
+TEST_CASE(LevelsFollowFreeMemory) {
+    auto& policy = MemoryPolicy::GetInstance();
+    host_heap_set_budget(HEAP_BUDGET_BYTES);
+    std::vector<void*> blocks;
+    policy.Update();
+    CHECK_EQ(policy.level(), kMemoryPressureNormal);
+
+    // Down to 30 KB free: low
+    blocks.push_back(heap_caps_malloc(HEAP_BUDGET_BYTES - 30 * 1024, MALLOC_CAP_INTERNAL));
+    CHECK(policy.Update());
+    CHECK_EQ(policy.level(), kMemoryPressureLow);
+    // Down to 10 KB free: critical
+    blocks.push_back(heap_caps_malloc(20 * 1024, MALLOC_CAP_INTERNAL));
+    CHECK(policy.Update());
+    CHECK_EQ(policy.level(), kMemoryPressureCritical);
+    // 22 KB free is above the critical watermark but inside its restore margin
+    heap_caps_free(blocks.back());
+    blocks.pop_back();
+    blocks.push_back(heap_caps_malloc(8 * 1024, MALLOC_CAP_INTERNAL));
+    CHECK(!policy.Update());
+    CHECK_EQ(policy.level(), kMemoryPressureCritical);
+
+    FreeAll(blocks);
+    CHECK(policy.Update());
+    CHECK_EQ(policy.level(), kMemoryPressureNormal);
+}
+
+// Allocations of audio packet and JSON sizes come and go under a budget that leaves the
+// device hovering around the critical watermark. The level may change, but must not flap
+// on every update, and the wake word clip must always keep a whole wake word.
+TEST_CASE(StressAroundCriticalWatermark) {
+    auto& policy = MemoryPolicy::GetInstance();
+    host_heap_set_budget(MEMORY_CRITICAL_SRAM_BYTES * 2);
+    host_heap_reset_stats();
+    std::vector<void*> blocks;
+    // Baseline usage leaves 4 KB above the critical watermark
+    blocks.push_back(heap_caps_malloc(MEMORY_CRITICAL_SRAM_BYTES - 4 * 1024, MALLOC_CAP_INTERNAL));
+
+    std::mt19937 random(30);
+    std::vector<void*> transient;
+    int changes = 0;
+    int failed_allocations = 0;
+    for (int step = 0; step < 20000; step++) {
+        if (transient.size() < 8 && random() % 2 == 0) {
+            // An Opus packet, or now and then a JSON message
+            size_t size = random() % 10 == 0 ? 1024 + random() % 2048 : 60 + random() % 200;
+            void* block = heap_caps_malloc(size, MALLOC_CAP_INTERNAL);
+            if (block == nullptr) {
+                failed_allocations++;
+            } else {
+                transient.push_back(block);
+            }
+        } else if (!transient.empty()) {
+            size_t index = random() % transient.size();
+            heap_caps_free(transient[index]);
+            transient.erase(transient.begin() + index);
+        }
+        if (policy.Update()) {
+            changes++;
+        }
+        CHECK(MemoryPolicy::GetWakeWordHistoryMs(policy.level()) >= WAKE_WORD_PCM_HISTORY_MIN_MS);
+    }
+    CHECK_EQ(failed_allocations, 0);
+    CHECK(policy.level() != kMemoryPressureNormal);
+    // Without the restore margin this pattern changes level thousands of times
+    CHECK(changes < 50);
+    std::printf("level changes: %d, peak heap use: %zu bytes\n", changes, host_heap_stats().peak_bytes);
+
+    FreeAll(transient);
+    FreeAll(blocks);
+    host_heap_set_budget(HEAP_BUDGET_BYTES);
+    policy.Update();
+}
+
+TEST_CASE(WakeWordHistoryNeverShorterThanMinimum) {
+    CHECK_EQ(MemoryPolicy::GetWakeWordHistoryMs(kMemoryPressureNormal), WAKE_WORD_PCM_HISTORY_MS);
+    CHECK_EQ(MemoryPolicy::GetWakeWordHistoryMs(kMemoryPressureLow), WAKE_WORD_PCM_HISTORY_MIN_MS);
+    CHECK_EQ(MemoryPolicy::GetWakeWordHistoryMs(kMemoryPressureCritical), WAKE_WORD_PCM_HISTORY_MIN_MS);
+    CHECK(WAKE_WORD_PCM_HISTORY_MIN_MS >= 1500);
+}
+
+TEST_MAIN()
@@ -0,0 +1,183 @@
+#include "test_harness.h"
+#include "network_sender.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+#define BLOCK_EVERY 5
+#define BLOCK_MS 30
+
+static double Ms(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// A link that stalls every few writes, like a WebSocket send waiting for TCP window space
+class BlockingTransport {
+public:
+    void Send(const std::string& message) {
+        if (++sends_ % BLOCK_EVERY == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(BLOCK_MS));
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        log_.push_back(message);
+    }
+
+    std::vector<std::string> log() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return log_;
+    }
+
+private:
+    std::atomic<int> sends_ = 0;
+    std::mutex mutex_;
+    std::vector<std::string> log_;
+};
+
+// The application side: an audio send queue filled by the encoder, drained by the sender
+struct Harness {
+    BlockingTransport transport;
+    std::mutex queue_mutex;
+    std::deque<int> audio_queue;
+    NetworkSender sender{[this]() { return SendQueuedAudio(); }};
+    std::thread sender_thread{[this]() { sender.Run(); }};
+
+    ~Harness() {
+        sender.Stop();
+        sender_thread.join();
+    }
+
+    void PushAudio(int sequence) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            audio_queue.push_back(sequence);
+        }
+        sender.NotifyAudio();
+    }
+
+    bool SendQueuedAudio() {
+        int sequence;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (audio_queue.empty()) {
+                return false;
+            }
+            sequence = audio_queue.front();
+            audio_queue.pop_front();
+        }
+        transport.Send("a" + std::to_string(sequence));
+        return true;
+    }
+
+    void FlushQueuedAudio() {
+        while (SendQueuedAudio()) {
+        }
+    }
+};
+
+#define AUDIO_PACKETS 400
+#define CONTROL_MESSAGES 40
+
+TEST_CASE(MainLoopNeverWaitsForTheLink) {
+    Harness harness;
+    std::atomic<bool> encoding = true;
+    std::thread encoder([&]() {
+        for (int i = 0; i < AUDIO_PACKETS; i++) {
+            harness.PushAudio(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        encoding = false;
+    });
+
+    // The main loop posts control messages, e.g. listen start/stop and MCP replies
+    std::vector<Clock::time_point> posted(CONTROL_MESSAGES);
+    std::vector<Clock::time_point> sent(CONTROL_MESSAGES);
+    double max_post_ms = 0;
+    for (int i = 0; i < CONTROL_MESSAGES; i++) {
+        posted[i] = Clock::now();
+        harness.sender.Post([&, i]() {
+            sent[i] = Clock::now();
+            harness.transport.Send("c" + std::to_string(i));
+        });
+        max_post_ms = std::max(max_post_ms, Ms(Clock::now() - posted[i]));
+        std::this_thread::sleep_for(std::chrono::milliseconds(7));
+    }
+    encoder.join();
+
+    // Like StopListening: the audio already encoded goes out before the stop message
+    std::atomic<bool> stopped = false;
+    harness.sender.Post([&]() {
+        harness.FlushQueuedAudio();
+        harness.transport.Send("stop");
+        stopped = true;
+    });
+    while (!stopped) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto log = harness.transport.log();
+    CHECK_EQ(log.size(), (size_t)(AUDIO_PACKETS + CONTROL_MESSAGES + 1));
+    CHECK(log.back() == "stop");
+    int next_audio = 0, next_control = 0;
+    for (auto& message : log) {
+        if (message[0] == 'a') {
+            CHECK_EQ(std::stoi(message.substr(1)), next_audio);
+            next_audio++;
+        } else if (message[0] == 'c') {
+            CHECK_EQ(std::stoi(message.substr(1)), next_control);
+            next_control++;
+        }
+    }
+    CHECK_EQ(next_audio, AUDIO_PACKETS);
+    CHECK_EQ(next_control, CONTROL_MESSAGES);
+
+    double max_control_ms = 0;
+    for (int i = 0; i < CONTROL_MESSAGES; i++) {
+        max_control_ms = std::max(max_control_ms, Ms(sent[i] - posted[i]));
+    }
+    std::printf("link blocks %d ms every %d writes: main loop post max %.3f ms, control message waited max %.1f ms\n",
+        BLOCK_MS, BLOCK_EVERY, max_post_ms, max_control_ms);
+    // Posting never waits for a write, a control message waits for at most the write in progress
+    CHECK(max_post_ms < BLOCK_MS / 3.0);
+    CHECK(max_control_ms < BLOCK_MS * 3);
+}
+
+// What the MQTT goodbye handler and the warm idle timer did before: write from the main loop
+TEST_CASE(WritingFromTheMainLoopStallsIt) {
+    BlockingTransport transport;
+    double max_stall_ms = 0;
+    for (int i = 0; i < 2 * BLOCK_EVERY; i++) {
+        auto start = Clock::now();
+        transport.Send("ping");
+        max_stall_ms = std::max(max_stall_ms, Ms(Clock::now() - start));
+    }
+    std::printf("direct write from the main loop: stalled max %.1f ms\n", max_stall_ms);
+    CHECK(max_stall_ms >= BLOCK_MS * 0.9);
+}
+
+// A timer callback or a receive handler that posts a write gets it run on the sender thread
+TEST_CASE(PostedTasksRunOnTheSenderThread) {
+    Harness harness;
+    std::atomic<bool> done = false;
+    std::thread::id ran_on;
+    std::thread timer([&]() {
+        harness.sender.Post([&]() {
+            ran_on = std::this_thread::get_id();
+            done = true;
+        });
+    });
+    timer.join();
+    while (!done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(ran_on == harness.sender_thread.get_id());
+}
+
+TEST_MAIN()
@@ -0,0 +1,8 @@
+#ifndef HOST_STUB_CJSON_H
+#define HOST_STUB_CJSON_H
+
+// Used when the cJSON sources are not available. protocol.h only needs the type name,
+// tests that parse or build JSON are not built in that case.
+typedef struct cJSON cJSON;
+
+#endif // HOST_STUB_CJSON_H
@@ -0,0 +1,81 @@
+#include "esp_heap_caps.h"
+
+#include <cstdlib>
+#include <mutex>
+
+static std::mutex g_mutex;
+static size_t g_budget = SIZE_MAX / 2;
+static HostHeapStats g_stats = {};
+static HostHeapObserver g_observer = nullptr;
+
+// Each block is prefixed with its size
+struct alignas(16) BlockHeader {
+    size_t size;
+};
+
+void* heap_caps_malloc(size_t size, uint32_t) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_stats.bytes_in_use + size > g_budget) {
+        g_stats.failures++;
+        return nullptr;
+    }
+    auto header = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+    if (header == nullptr) {
+        g_stats.failures++;
+        return nullptr;
+    }
+    header->size = size;
+    g_stats.allocations++;
+    g_stats.bytes_in_use += size;
+    if (g_stats.bytes_in_use > g_stats.peak_bytes) {
+        g_stats.peak_bytes = g_stats.bytes_in_use;
+    }
+    if (g_observer != nullptr) {
+        g_observer(header + 1, size);
+    }
+    return header + 1;
+}
+
+void heap_caps_free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto header = (BlockHeader*)ptr - 1;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_stats.frees++;
+        g_stats.bytes_in_use -= header->size;
+        if (g_observer != nullptr) {
+            g_observer(ptr, 0);
+        }
+    }
+    free(header);
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_stats.bytes_in_use >= g_budget ? 0 : g_budget - g_stats.bytes_in_use;
+}
+
+void host_heap_set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_budget = bytes;
+}
+
+HostHeapStats host_heap_stats() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_stats;
+}
+
+void host_heap_reset_stats() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    size_t bytes_in_use = g_stats.bytes_in_use;
+    g_stats = {};
+    g_stats.bytes_in_use = bytes_in_use;
+    g_stats.peak_bytes = bytes_in_use;
+}
+
+void host_heap_set_observer(HostHeapObserver observer) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_observer = observer;
+}
@@ -0,0 +1,34 @@
+#ifndef HOST_STUB_ESP_HEAP_CAPS_H
+#define HOST_STUB_ESP_HEAP_CAPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// A counting heap with a fixed budget. heap_caps_malloc fails once the bytes in use would
+// exceed the budget, every capability shares the same budget.
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+
+struct HostHeapStats {
+    size_t allocations;
+    size_t frees;
+    size_t failures;
+    size_t bytes_in_use;
+    size_t peak_bytes;
+};
+
+void host_heap_set_budget(size_t bytes);
+HostHeapStats host_heap_stats();
+void host_heap_reset_stats();
+
+// Sees every block handed out (size > 0) and taken back (size 0), for tests that model
+// the layout of the device heap. Called with the heap lock held.
+typedef void (*HostHeapObserver)(const void* ptr, size_t size);
+void host_heap_set_observer(HostHeapObserver observer);
+
+#endif // HOST_STUB_ESP_HEAP_CAPS_H
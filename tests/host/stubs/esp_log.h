@@ -0,0 +1,15 @@
+#ifndef HOST_STUB_ESP_LOG_H
+#define HOST_STUB_ESP_LOG_H
+
+// Firmware logs use %lu for uint32_t, which is unsigned long only on the device.
+// The arguments are evaluated and dropped so the format strings are not checked here.
+template<typename... Args>
+inline void esp_log_stub(const char*, const char*, const Args&...) {}
+
+#define ESP_LOGE(tag, format, ...) esp_log_stub(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_stub(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_stub(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_stub(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_stub(tag, format, ##__VA_ARGS__)
+
+#endif // HOST_STUB_ESP_LOG_H
@@ -0,0 +1,17 @@
+#include "esp_timer.h"
+
+#include <atomic>
+
+static std::atomic<int64_t> g_time_us = 0;
+
+int64_t esp_timer_get_time() {
+    return g_time_us.load();
+}
+
+void host_timer_set_time(int64_t time_us) {
+    g_time_us = time_us;
+}
+
+void host_timer_advance(int64_t delta_us) {
+    g_time_us += delta_us;
+}
@@ -0,0 +1,13 @@
+#ifndef HOST_STUB_ESP_TIMER_H
+#define HOST_STUB_ESP_TIMER_H
+
+#include <cstdint>
+
+typedef struct esp_timer* esp_timer_handle_t;
+
+// A manual clock, it only moves when a test advances it
+int64_t esp_timer_get_time();
+void host_timer_set_time(int64_t time_us);
+void host_timer_advance(int64_t delta_us);
+
+#endif // HOST_STUB_ESP_TIMER_H
@@ -0,0 +1,70 @@
+#ifndef HOST_TEST_HARNESS_H
+#define HOST_TEST_HARNESS_H
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+/*
+ * Minimal test runner for the host tests, every test file is its own executable.
+ *
+ *   TEST_CASE(Trigger) {
+ *       CHECK(endpointer.Feed(false, 60));
+ *       CHECK_EQ(endpointer.utterance_ms(), 900);
+ *   }
+ *   TEST_MAIN()
+ */
+
+struct HostTest {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<HostTest>& HostTests() {
+    static std::vector<HostTest> tests;
+    return tests;
+}
+
+inline int& HostTestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct HostTestRegistrar {
+    HostTestRegistrar(const char* name, void (*run)()) { HostTests().push_back({name, run}); }
+};
+
+#define TEST_CASE(name) \
+    static void test_##name(); \
+    static HostTestRegistrar registrar_##name(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            HostTestFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        auto actual_value = (actual); \
+        auto expected_value = (expected); \
+        if (!(actual_value == expected_value)) { \
+            std::printf("%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #actual, #expected); \
+            HostTestFailures()++; \
+        } \
+    } while (0)
+
+#define TEST_MAIN() \
+    int main() { \
+        for (auto& test : HostTests()) { \
+            int failures = HostTestFailures(); \
+            test.run(); \
+            std::printf("%s %s\n", HostTestFailures() == failures ? "PASS" : "FAIL", test.name); \
+        } \
+        return HostTestFailures() == 0 ? 0 : 1; \
+    }
+
+#endif // HOST_TEST_HARNESS_H
@@ -0,0 +1,161 @@
+// Receive path of MqttProtocol over a loopback UDP socket: one datagram per Opus frame,
+// parsed and copied into a packet that is handed to a stand-in decoder. Compares a new
+// packet per datagram with packets taken from AudioPacketPool.
+//
+// AES-CTR is left out, it runs once per byte in both variants and writes into the
+// packet payload in place of the memcpy below.
+
+#include "test_harness.h"
+#include "audio_packet_pool.h"
+#include "udp_audio_header.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+
+static std::atomic<size_t> g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+#define PACKETS 100000
+#define BATCH 32
+#define OPUS_FRAME_SIZE 180
+
+static double CpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double WallSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct Result {
+    double packets_per_second;
+    double allocations_per_packet;
+    double cpu_us_per_packet;
+};
+
+static Result Run(bool pooled) {
+    int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(receiver, (sockaddr*)&address, sizeof(address));
+    socklen_t address_size = sizeof(address);
+    getsockname(receiver, (sockaddr*)&address, &address_size);
+    connect(sender, (sockaddr*)&address, sizeof(address));
+
+    uint8_t datagram[UDP_AUDIO_HEADER_SIZE + OPUS_FRAME_SIZE] = {UDP_AUDIO_PACKET_TYPE};
+    // The Udp component hands each datagram over in a reused std::string
+    std::string data;
+    data.reserve(2048);
+    size_t decoded_bytes = 0;
+
+    size_t allocations = 0;
+    double cpu_start = 0;
+    double wall_start = 0;
+    for (int sent = 0; sent < PACKETS; sent += BATCH) {
+        if (sent == BATCH * 4) {
+            // Warmed up, the pool holds its packets now
+            allocations = g_allocations;
+            cpu_start = CpuSeconds();
+            wall_start = WallSeconds();
+        }
+        for (int i = 0; i < BATCH; i++) {
+            uint32_t sequence = htonl(sent + i);
+            memcpy(datagram + 12, &sequence, sizeof(sequence));
+            send(sender, datagram, sizeof(datagram), 0);
+        }
+        for (int i = 0; i < BATCH; i++) {
+            data.resize(2048);
+            ssize_t size = recv(receiver, &data[0], data.size(), 0);
+            data.resize(size > 0 ? size : 0);
+            UdpAudioHeader header;
+            if (!ParseUdpAudioHeader(data, header)) {
+                continue;
+            }
+            auto packet = pooled ? AudioPacketPool::GetInstance().Acquire() : std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = 24000;
+            packet->frame_duration = 60;
+            packet->timestamp = header.timestamp;
+            packet->payload.resize(data.size() - UDP_AUDIO_HEADER_SIZE);
+            memcpy(packet->payload.data(), data.data() + UDP_AUDIO_HEADER_SIZE, packet->payload.size());
+            // The decoder reads the payload and gives the packet back
+            decoded_bytes += packet->payload.size();
+            if (pooled) {
+                AudioPacketPool::GetInstance().Release(std::move(packet));
+            }
+        }
+    }
+    size_t measured = PACKETS - BATCH * 4;
+    Result result;
+    result.packets_per_second = measured / (WallSeconds() - wall_start);
+    result.allocations_per_packet = (double)(g_allocations - allocations) / measured;
+    result.cpu_us_per_packet = (CpuSeconds() - cpu_start) * 1e6 / measured;
+    close(sender);
+    close(receiver);
+    CHECK_EQ(decoded_bytes, (size_t)PACKETS * OPUS_FRAME_SIZE);
+    return result;
+}
+
+TEST_CASE(PooledReceiveAllocatesNothing) {
+    auto allocating = Run(false);
+    auto pooled = Run(true);
+    std::printf("new packet per datagram: %.0f packets/s, %.2f allocations/packet, %.2f us CPU/packet\n",
+        allocating.packets_per_second, allocating.allocations_per_packet, allocating.cpu_us_per_packet);
+    std::printf("pooled packets:          %.0f packets/s, %.2f allocations/packet, %.2f us CPU/packet\n",
+        pooled.packets_per_second, pooled.allocations_per_packet, pooled.cpu_us_per_packet);
+    CHECK(allocating.allocations_per_packet >= 2.0);
+    CHECK(pooled.allocations_per_packet < 0.01);
+    auto statistics = AudioPacketPool::GetInstance().statistics();
+    CHECK(statistics.reused + 1 >= statistics.acquired);
+}
+
+TEST_CASE(OversizedPayloadNotKept) {
+    auto& pool = AudioPacketPool::GetInstance();
+    pool.Clear();
+    auto packet = pool.Acquire();
+    packet->payload.resize(AUDIO_PACKET_POOL_MAX_PAYLOAD + 1);
+    pool.Release(std::move(packet));
+    uint32_t reused = pool.statistics().reused;
+    packet = pool.Acquire();
+    CHECK_EQ(pool.statistics().reused, reused);
+
+    packet->payload.resize(200);
+    packet->timestamp = 42;
+    auto address = packet.get();
+    pool.Release(std::move(packet));
+    packet = pool.Acquire();
+    CHECK(packet.get() == address);
+    CHECK(packet->payload.empty());
+    CHECK(packet->payload.capacity() >= 200);
+    CHECK_EQ(packet->timestamp, 0u);
+}
+
+TEST_MAIN()